@@ -0,0 +1,156 @@
+#include "alloccounter.h"
+#include <cstdlib>
+#include <new>
+#ifdef _WIN32
+#include <malloc.h> // _aligned_malloc
+#endif
+
+namespace {
+
+// Constant initialised, so it's safe to touch in allocations made while a
+// thread starts or exits
+thread_local unsigned long long allocations = 0;
+
+void* allocate(std::size_t size) {
+    ++allocations;
+    if (size == 0)
+        size = 1;
+    for (;;) {
+        if (void* p = std::malloc(size))
+            return p;
+        std::new_handler handler = std::get_new_handler();
+        if (!handler)
+            throw std::bad_alloc();
+        handler();
+    }
+}
+
+void* allocate_aligned(std::size_t size, std::align_val_t alignment) {
+    ++allocations;
+    auto align = static_cast<std::size_t>(alignment);
+    // aligned_alloc wants a multiple of the alignment
+    size = size == 0 ? align : (size + align - 1) / align * align;
+    for (;;) {
+#ifdef _WIN32
+        void* p = _aligned_malloc(size, align);
+#else
+        void* p = std::aligned_alloc(align, size);
+#endif
+        if (p)
+            return p;
+        std::new_handler handler = std::get_new_handler();
+        if (!handler)
+            throw std::bad_alloc();
+        handler();
+    }
+}
+
+void free_aligned(void* p) {
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+} // namespace
+
+unsigned long long thread_allocations() {
+    return allocations;
+}
+
+void* operator new(std::size_t size) {
+    return allocate(size);
+}
+
+void* operator new[](std::size_t size) {
+    return allocate(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return allocate(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return allocate(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    return allocate_aligned(size, alignment);
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+    return allocate_aligned(size, alignment);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    try {
+        return allocate_aligned(size, alignment);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    try {
+        return allocate_aligned(size, alignment);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+    free_aligned(p);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept {
+    free_aligned(p);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept {
+    free_aligned(p);
+}
+
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept {
+    free_aligned(p);
+}
+
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept {
+    free_aligned(p);
+}
+
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept {
+    free_aligned(p);
+}
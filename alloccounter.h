@@ -0,0 +1,13 @@
+#ifndef MINACALC_ALLOCCOUNTER_H
+#define MINACALC_ALLOCCOUNTER_H
+
+/* Number of heap allocations (calls of any operator new) the calling
+thread has made so far. alloccounter.cpp counts them by replacing the global
+operator new and delete, which is only done in the executables: a library
+shouldn't swap out its user's allocator. So the library can't call this
+itself; the executables hand it in, e.g. as BatchOptions::thread_allocations.
+Work handed to other threads (a CalcOptions::executor's jobs, say) is
+counted on those threads, so whoever hands it out has to add it up. */
+unsigned long long thread_allocations();
+
+#endif //MINACALC_ALLOCCOUNTER_H
@@ -0,0 +1,581 @@
+#include "batch.h"
+#include "chartcache.h"
+#include "contenthash.h"
+#include "mappedfile.h"
+#include "perfcounters.h"
+#include "ratingcache.h"
+#include "smloader.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace fs = std::filesystem;
+
+using std::string;
+using std::vector;
+
+namespace {
+
+struct FileResult {
+    bool opened = false;
+    vector<ChartRating> charts;
+    vector<CalcStats> stats; // One per chart, if BatchOptions::stats is set
+
+    void Resize(size_t chart_count, bool with_stats) {
+        charts.resize(chart_count);
+        if (with_stats)
+            stats.resize(chart_count);
+    }
+
+    CalcStats* ChartStats(size_t d) { return stats.empty() ? nullptr : &stats[d]; }
+};
+
+bool is_sm_file(const fs::path& path) {
+    string extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    return extension == ".sm";
+}
+
+// Sorted, so the output order doesn't depend on the file system. A root that
+// is a file is taken as it is.
+bool find_sm_files(const string& root, vector<string>& paths) {
+    std::error_code error;
+    if (fs::is_regular_file(root, error)) {
+        paths.push_back(root);
+        return true;
+    }
+    fs::recursive_directory_iterator it(root, fs::directory_options::skip_permission_denied, error);
+    if (error) {
+        std::cerr << "failed to open directory " << root << ": " << error.message() << '\n';
+        return false;
+    }
+    for (; it != fs::recursive_directory_iterator(); it.increment(error)) {
+        if (error)
+            break;
+        if (it->is_regular_file(error) && is_sm_file(it->path()))
+            paths.push_back(it->path().string());
+    }
+    std::sort(paths.begin(), paths.end());
+    return true;
+}
+
+// The loader keeps the whitespace around the difficulty name
+string trim(const string& s) {
+    size_t first = s.find_first_not_of(" \t\r\n");
+    if (first == string::npos)
+        return string();
+    size_t last = s.find_last_not_of(" \t\r\n");
+    return s.substr(first, last - first + 1);
+}
+
+void print_chart(std::ostream& out, const string& path, const ChartRating& chart) {
+    const DifficultyRating& r = chart.rating;
+    out << path << '\t' << chart.difficultyName
+        << '\t' << r.overall << '\t' << r.stream << '\t' << r.jumpstream
+        << '\t' << r.handstream << '\t' << r.stamina << '\t' << r.jack
+        << '\t' << r.chordjack << '\t' << r.technical << '\n';
+}
+
+// Cached charts are decoded into this, so every thread keeps the buffers
+// of one PreparedChart from chart to chart; the Calc's are kept by
+// MinaSDCalc's own per thread workspace
+PreparedChart& thread_chart() {
+    static thread_local PreparedChart chart;
+    return chart;
+}
+
+/* Hands the jobs on to `executor` and counts the heap allocations of the
+ones that run on other threads than the one it was made on, which that
+thread's own count doesn't see. */
+class CountingExecutor
+{
+public:
+    CountingExecutor(const CalcExecutor& executor, unsigned long long (*thread_allocations)())
+        : executor(executor), thread_allocations(thread_allocations), caller(std::this_thread::get_id()) {}
+
+    void operator()(size_t count, const std::function<void(size_t)>& job) {
+        executor(count, [this, &job](size_t i) {
+            if (std::this_thread::get_id() == caller) {
+                job(i);
+                return;
+            }
+            unsigned long long before = thread_allocations();
+            job(i);
+            allocations += thread_allocations() - before;
+        });
+    }
+
+    unsigned long long Allocations() const { return allocations.load(); }
+
+private:
+    const CalcExecutor& executor;
+    unsigned long long (*thread_allocations)();
+    std::thread::id caller;
+    std::atomic<unsigned long long> allocations{0};
+};
+
+// State shared by the rating tasks of one batch
+struct RatingRun {
+    explicit RatingRun(const BatchOptions& options) : options(options) {}
+
+    bool OpenRatingCache() {
+        if (options.rating_cache.empty())
+            return true;
+        if (!rating_cache.Open(options.rating_cache)) {
+            std::cerr << "failed to open rating cache " << options.rating_cache << '\n';
+            return false;
+        }
+        use_rating_cache = true;
+        return true;
+    }
+
+    // These go through the rating cache, if there is one. `stats` may be
+    // null; charts found in the cache leave it alone.
+    void Rate(const vector<NoteInfo>& notes, DifficultyRating& rating, CalcStats* stats) {
+        auto calculate = [&](const CalcOptions& calc) {
+            return MinaSDCalc(notes, options.music_rate, options.score_goal, calc);
+        };
+        if (!use_rating_cache) {
+            Calculate(calculate, rating, stats);
+            return;
+        }
+        RatingKey key = MakeRatingKey(notes, options.music_rate, options.score_goal, options.calc);
+        if (Lookup(key, rating))
+            return;
+        Calculate(calculate, rating, stats);
+        rating_cache.Put(key, rating);
+    }
+
+    // Keyed by the hash the chart cache stored, so hits don't decode the rows
+    void Rate(const CachedChart& chart, DifficultyRating& rating, CalcStats* stats) {
+        auto calculate = [&](const CalcOptions& calc) {
+            PreparedChart& prepared = thread_chart();
+            chart.Prepare(prepared);
+            return MinaSDCalc(prepared, options.music_rate, options.score_goal, calc);
+        };
+        if (!use_rating_cache) {
+            Calculate(calculate, rating, stats);
+            return;
+        }
+        RatingKey key = MakeRatingKey(chart.content_hash, options.music_rate, options.score_goal, options.calc);
+        if (Lookup(key, rating))
+            return;
+        Calculate(calculate, rating, stats);
+        rating_cache.Put(key, rating);
+    }
+
+    bool Lookup(const RatingKey& key, DifficultyRating& rating) {
+        if (!rating_cache.Get(key, rating))
+            return false;
+        ++rated;
+        return true;
+    }
+
+    // Rates a chart with `calculate(calc)`, which gets the batch's
+    // CalcOptions with this chart's counters in them
+    template <typename F>
+    void Calculate(F calculate, DifficultyRating& rating, CalcStats* stats) {
+        unsigned long long allocations = options.thread_allocations ? options.thread_allocations() : 0;
+        SearchStats chart_evaluations;
+        CalcOptions calc = options.calc;
+        calc.search_stats = &chart_evaluations;
+        calc.calc_stats = stats;
+        CountingExecutor counting(options.calc.executor, options.thread_allocations);
+        if (options.thread_allocations && options.calc.executor)
+            calc.executor = [&counting](size_t count, const std::function<void(size_t)>& job) {
+                counting(count, job);
+            };
+        rating = calculate(calc);
+        ++rated;
+        if (options.thread_allocations) {
+            allocations = options.thread_allocations() - allocations + counting.Allocations();
+            calc_allocations += allocations;
+            allocating_calcs += allocations > 0;
+        }
+        ++calculated;
+
+        std::lock_guard<std::mutex> lock(evaluations_mutex);
+        evaluations.Add(chart_evaluations);
+    }
+
+    // Prints the ratings to stdout and the summary to stderr
+    void Report(const vector<string>& paths, const vector<FileResult>& results,
+                std::chrono::steady_clock::time_point start, unsigned int threads) {
+        for (size_t i = 0; i < paths.size(); i++) {
+            if (!results[i].opened)
+                std::cerr << "failed to open " << paths[i] << '\n';
+            for (const ChartRating& chart : results[i].charts)
+                print_chart(std::cout, paths[i], chart);
+        }
+        std::cout.flush();
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cerr << "Rated " << rated.load() << " charts from " << paths.size() << " files in "
+                  << elapsed.count() << "s (" << rated.load() / std::max(elapsed.count(), 1e-9)
+                  << " charts/sec, " << threads << " threads)" << '\n';
+        std::cerr << "Score evaluations: " << evaluations.Total() << " (stream " << evaluations.chisel[STREAM]
+                  << ", js " << evaluations.chisel[JS] << ", hs " << evaluations.chisel[HS]
+                  << ", tech " << evaluations.chisel[TECH] << ", jack " << evaluations.chisel[JACK]
+                  << ", stamina " << evaluations.chisel[STAMINA_CHISEL] << ", overall " << evaluations.aggregate << ")" << std::endl;
+        if (options.thread_allocations)
+            std::cerr << "Heap allocations while rating: " << calc_allocations.load() << " in "
+                      << allocating_calcs.load() << " of " << calculated.load() << " calculations" << std::endl;
+        if (!options.stats.empty())
+            ReportStats(paths, results);
+        if (use_rating_cache) {
+            RatingCache::Stats cache_stats = rating_cache.GetStats();
+            std::cerr << "Rating cache: " << cache_stats.memory_hits << " memory hits, " << cache_stats.disk_hits
+                      << " disk hits, " << cache_stats.misses << " misses, " << cache_stats.stored
+                      << " ratings stored" << std::endl;
+        }
+    }
+
+    // Writes every chart's stats to options.stats and their sum to stderr
+    void ReportStats(const vector<string>& paths, const vector<FileResult>& results) {
+        std::ofstream out(options.stats, std::ios::trunc);
+        if (!out) {
+            std::cerr << "failed to open " << options.stats << '\n';
+            return;
+        }
+        out << "path\tdifficulty\tcalculations\tintervals\treserved_bytes\tscore_calls\tjack_loss_calls\tstam_adjust_calls";
+        for (int phase = 0; phase < CalcStats::NUM_PHASES; phase++)
+            out << '\t' << CalcStats::PhaseName(phase) << " ms";
+        out << '\n';
+
+        CalcStats total;
+        for (size_t i = 0; i < paths.size(); i++)
+            for (size_t d = 0; d < results[i].stats.size(); d++) {
+                const CalcStats& stats = results[i].stats[d];
+                total.Add(stats);
+                out << paths[i] << '\t' << results[i].charts[d].difficultyName << '\t' << stats.calculations
+                    << '\t' << stats.intervals << '\t' << stats.reserved_bytes << '\t' << stats.ScoreCalls()
+                    << '\t' << stats.jack_loss_calls << '\t' << stats.stam_adjust_calls;
+                for (double seconds : stats.seconds)
+                    out << '\t' << seconds * 1000.0;
+                out << '\n';
+            }
+
+        std::cerr << "Calc stats: " << total.calculations << " calculations, " << total.intervals << " intervals, "
+                  << total.ScoreCalls() << " score calls, " << total.jack_loss_calls << " JackLoss calls, "
+                  << total.stam_adjust_calls << " StamAdjust calls, largest working storage "
+                  << total.reserved_bytes << " bytes reserved" << '\n';
+        double calc_main = total.seconds[CalcStats::CALC_MAIN];
+        for (int phase = 0; phase < CalcStats::NUM_PHASES; phase++)
+            std::cerr << "    " << CalcStats::PhaseName(phase) << ": " << total.seconds[phase] * 1000.0 << " ms ("
+                      << 100.0 * total.seconds[phase] / std::max(calc_main, 1e-12) << "%)" << '\n';
+    }
+
+    const BatchOptions& options;
+    std::atomic<size_t> rated{0};
+    std::atomic<size_t> calculated{0}; // Not found in the rating cache
+    std::atomic<unsigned long long> calc_allocations{0};
+    std::atomic<size_t> allocating_calcs{0};
+    SearchStats evaluations;
+    std::mutex evaluations_mutex;
+    RatingCache rating_cache;
+    bool use_rating_cache = false;
+};
+
+int rate_cache(const BatchOptions& options) {
+    auto start = std::chrono::steady_clock::now();
+
+    ChartCache cache;
+    if (!cache.Open(options.cache)) {
+        std::cerr << "failed to open chart cache " << options.cache << '\n';
+        return 1;
+    }
+    const vector<CachedFile>& files = cache.Files();
+    vector<string> paths;
+    vector<FileResult> results(files.size());
+    for (const CachedFile& file : files)
+        paths.emplace_back(file.path);
+
+    RatingRun run(options);
+    if (!run.OpenRatingCache())
+        return 1;
+    unsigned int threads;
+    {
+        ThreadPool pool(options.threads);
+        threads = pool.Size();
+
+        // The rows are decoded from the mapping inside each task
+        for (size_t i = 0; i < files.size(); i++) {
+            FileResult& result = results[i];
+            result.opened = true;
+            result.Resize(files[i].charts.size(), !options.stats.empty());
+            for (size_t d = 0; d < files[i].charts.size(); d++) {
+                const CachedChart& chart = files[i].charts[d];
+                result.charts[d].difficultyName = trim(string(chart.name));
+                pool.Submit([&run, &result, &chart, d] {
+                    run.Rate(chart, result.charts[d].rating, result.ChartStats(d));
+                });
+            }
+        }
+        pool.Wait();
+    }
+
+    run.Report(paths, results, start, threads);
+    return 0;
+}
+
+// Reads the counters around each phase of a CalcMain
+class PhaseProfiler : public CalcObserver
+{
+public:
+    explicit PhaseProfiler(PerfCounters& counters) : counters(counters) {}
+
+    void PhaseBegin(CalcPhase) override { counters.Start(); }
+    void PhaseEnd(CalcPhase phase) override { counters.Stop(samples[phase]); }
+
+    void Reset() {
+        for (PerfSample& sample : samples)
+            sample = PerfSample();
+    }
+
+    PerfCounters& counters;
+    PerfSample samples[NUM_CALC_PHASES];
+};
+
+// What batch_profile reports per chart, besides the CalcPhases
+enum ProfilePhase { LOAD_PROFILE, PREPARE_PROFILE, NUM_PROFILE_PHASES = PREPARE_PROFILE + 1 + NUM_CALC_PHASES };
+
+const char* const profile_phase_names[NUM_PROFILE_PHASES] = {"load", "prepare", "init", "skillsets", "stamina"};
+
+void print_sample(std::ostream& out, const PerfCounters& counters, const PerfSample& sample) {
+    out << sample.seconds * 1000.0;
+    for (int c = 0; c < PerfSample::NUM_COUNTERS; c++) {
+        out << '\t';
+        if (counters.Has(static_cast<PerfSample::Counter>(c)))
+            out << sample.values[c];
+        else
+            out << '-';
+    }
+    bool has_ipc = counters.Has(PerfSample::CYCLES) && counters.Has(PerfSample::INSTRUCTIONS);
+    out << '\t';
+    if (has_ipc && sample.values[PerfSample::CYCLES] > 0)
+        out << static_cast<double>(sample.values[PerfSample::INSTRUCTIONS]) / sample.values[PerfSample::CYCLES];
+    else
+        out << '-';
+}
+
+/* Rates the files one chart at a time on this thread, reading the hardware
+counters around the loader, PreparedChart and each CalcPhase. Prints one tab
+separated line per file for the loader and one per chart and phase to stdout,
+and the totals per phase to stderr. */
+int batch_profile(const BatchOptions& options) {
+    vector<string> paths;
+    if (!find_sm_files(options.root, paths))
+        return 1;
+
+    PerfCounters counters;
+    if (!counters.Available())
+        std::cerr << "hardware counters not available (" << counters.Error() << "), only timing" << '\n';
+    PhaseProfiler profiler(counters);
+    CalcOptions calc = options.calc;
+    calc.executor = nullptr; // Counters only see this thread
+    calc.observer = &profiler;
+
+    PerfSample totals[NUM_PROFILE_PHASES];
+    std::cout << "path\tdifficulty\tphase\tms";
+    for (int c = 0; c < PerfSample::NUM_COUNTERS; c++)
+        std::cout << '\t' << PerfSample::CounterName(c);
+    std::cout << "\tipc\n";
+
+    auto print_line = [&](const string& path, const string& difficulty, int phase, const PerfSample& sample) {
+        std::cout << path << '\t' << difficulty << '\t' << profile_phase_names[phase] << '\t';
+        print_sample(std::cout, counters, sample);
+        std::cout << '\n';
+        totals[phase].Add(sample);
+    };
+
+    for (const string& path : paths) {
+        PerfSample load;
+        counters.Start();
+        SMNotes charts;
+        std::ifstream sm_file(path);
+        bool opened = sm_file.is_open();
+        if (opened)
+            charts = load_from_file(sm_file);
+        counters.Stop(load);
+        if (!opened) {
+            std::cerr << "failed to open " << path << '\n';
+            continue;
+        }
+        print_line(path, "-", LOAD_PROFILE, load);
+
+        for (const ChartInfo& chart : charts) {
+            string difficulty = trim(chart.difficultyName);
+            PerfSample prepare;
+            counters.Start();
+            PreparedChart prepared(chart.notes);
+            counters.Stop(prepare);
+
+            profiler.Reset();
+            MinaSDCalc(prepared, options.music_rate, options.score_goal, calc);
+            print_line(path, difficulty, PREPARE_PROFILE, prepare);
+            // Empty charts never get to CalcMain
+            if (prepared.empty())
+                continue;
+            for (int phase = 0; phase < NUM_CALC_PHASES; phase++)
+                print_line(path, difficulty, PREPARE_PROFILE + 1 + phase, profiler.samples[phase]);
+        }
+    }
+    std::cout.flush();
+
+    std::cerr << "Totals:\tms";
+    for (int c = 0; c < PerfSample::NUM_COUNTERS; c++)
+        std::cerr << '\t' << PerfSample::CounterName(c);
+    std::cerr << "\tipc" << '\n';
+    for (int phase = 0; phase < NUM_PROFILE_PHASES; phase++) {
+        std::cerr << profile_phase_names[phase] << '\t';
+        print_sample(std::cerr, counters, totals[phase]);
+        std::cerr << '\n';
+    }
+    std::cerr.flush();
+    return 0;
+}
+
+} // namespace
+
+int batchRate(const BatchOptions& options) {
+    if (options.profile)
+        return batch_profile(options);
+    if (!options.cache.empty()) {
+        if (!options.root.empty() && batchConvert(options) != 0)
+            return 1;
+        return rate_cache(options);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    vector<string> paths;
+    if (!find_sm_files(options.root, paths))
+        return 1;
+    vector<FileResult> results(paths.size());
+    RatingRun run(options);
+    if (!run.OpenRatingCache())
+        return 1;
+    unsigned int threads;
+
+    {
+        ThreadPool pool(options.threads);
+        threads = pool.Size();
+
+        for (size_t i = 0; i < paths.size(); i++) {
+            pool.Submit([&, i] {
+                std::ifstream sm_file(paths[i]);
+                if (!sm_file.is_open())
+                    return;
+                auto chart = std::make_shared<SMNotes>(load_from_file(sm_file));
+
+                FileResult& result = results[i];
+                result.opened = true;
+                result.Resize(chart->size(), !options.stats.empty());
+                for (size_t d = 0; d < chart->size(); d++) {
+                    result.charts[d].difficultyName = trim((*chart)[d].difficultyName);
+                    pool.Submit([&run, &result, chart, d] {
+                        run.Rate((*chart)[d].notes, result.charts[d].rating, result.ChartStats(d));
+                    });
+                }
+            });
+        }
+        pool.Wait();
+    }
+
+    run.Report(paths, results, start, threads);
+    return 0;
+}
+
+int batchConvert(const BatchOptions& options) {
+    auto start = std::chrono::steady_clock::now();
+
+    vector<string> paths;
+    if (!find_sm_files(options.root, paths))
+        return 1;
+
+    // The cache from the last run, if there is one. Files whose stamp
+    // matches are copied over from it without being read.
+    ChartCache previous;
+    std::unordered_map<std::string_view, const CachedFile*> previous_files;
+    if (previous.Open(options.cache))
+        for (const CachedFile& file : previous.Files())
+            previous_files[file.path] = &file;
+
+    vector<FileStamp> stamps(paths.size());
+    vector<const CachedFile*> unchanged(paths.size(), nullptr);
+    vector<SMNotes> charts(paths.size());
+    vector<uint64_t> hashes(paths.size());
+    vector<char> opened(paths.size(), 0);
+    std::atomic<size_t> parsed{0};
+    size_t kept = 0;
+    {
+        ThreadPool pool(options.threads);
+        pool.ParallelFor(paths.size(), [&](size_t i) {
+            auto found = previous_files.find(paths[i]);
+            const CachedFile* cached = found != previous_files.end() ? found->second : nullptr;
+            bool stamped = file_stamp(paths[i], stamps[i]);
+            if (cached && stamped && cached->stamp == stamps[i]) {
+                unchanged[i] = cached;
+                opened[i] = 1;
+                return;
+            }
+
+            MappedFile sm_file;
+            if (!sm_file.Open(paths[i]))
+                return;
+            opened[i] = 1;
+            hashes[i] = content_hash(sm_file.data(), sm_file.size());
+            // Touched, but the same bytes
+            if (cached && cached->content_hash == hashes[i]) {
+                unchanged[i] = cached;
+                return;
+            }
+            charts[i] = load_from_buffer(std::string_view(reinterpret_cast<const char*>(sm_file.data()), sm_file.size()));
+            ++parsed;
+        });
+    }
+
+    // Added in path order, so the cache doesn't depend on the thread count
+    ChartCacheWriter writer;
+    size_t chart_count = 0;
+    for (size_t i = 0; i < paths.size(); i++) {
+        if (!opened[i]) {
+            std::cerr << "failed to open " << paths[i] << '\n';
+            continue;
+        }
+        // Only files that make it into the new cache; one that can't be
+        // opened any more is dropped, so it counts as removed
+        kept += previous_files.count(paths[i]);
+        if (unchanged[i]) {
+            writer.AddFile(*unchanged[i], stamps[i]);
+            chart_count += unchanged[i]->charts.size();
+        } else {
+            writer.AddFile(paths[i], stamps[i], hashes[i], charts[i]);
+            chart_count += charts[i].size();
+        }
+    }
+    // Everything needed is copied, and the old cache can't be renamed over
+    // while it is mapped on every platform
+    size_t removed = previous.Files().size() - kept;
+    previous.Close();
+    if (!writer.Save(options.cache)) {
+        std::cerr << "failed to write chart cache " << options.cache << '\n';
+        return 1;
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cerr << "Cached " << chart_count << " charts from " << writer.FileCount() << " files in "
+              << elapsed.count() << "s (" << parsed.load() << " parsed, "
+              << writer.FileCount() - parsed.load() << " unchanged, " << removed << " removed)" << std::endl;
+    return 0;
+}
@@ -0,0 +1,51 @@
+#ifndef MINACALC_BATCH_H
+#define MINACALC_BATCH_H
+
+#include "minacalc.h"
+#include <string>
+
+struct BatchOptions {
+    std::string root; // Directory that is searched recursively for .sm files
+    // Chart cache (see chartcache.h) that batchRate rates instead of root,
+    // or that batchConvert writes
+    std::string cache;
+    // Rating cache (see ratingcache.h) to look ratings up in and add them to
+    std::string rating_cache;
+    // File the per chart CalcStats are written to, as tab separated values.
+    // Only with CALC_STATS_ENABLED.
+    std::string stats;
+    // Rate serially and report the hardware counters (see perfcounters.h)
+    // of each phase instead of the ratings. Only from root.
+    bool profile = false;
+    unsigned int threads = 0; // 0 means one per hardware thread
+    // If set, the heap allocations of every calculation are counted with
+    // it and reported, those of calc.executor's jobs on other threads
+    // included. See alloccounter.h.
+    unsigned long long (*thread_allocations)() = nullptr;
+    float music_rate = 1.f;
+    float score_goal = 0.93f;
+    CalcOptions calc;
+};
+
+/* Rates every chart in every .sm file below options.root. Files are parsed
+and rated on a work-stealing thread pool: each parse task submits one calc
+task per difficulty as soon as the file is loaded, so parsing and rating
+overlap and a slow file only holds up the worker that parses it. With
+options.cache set, the charts come from that chart cache instead; with both
+set, the cache is brought up to date with root first (see batchConvert). With
+options.rating_cache set, charts whose rating is cached aren't calculated
+again. With options.profile, profiles the charts instead of rating them. Prints one
+tab separated line per chart to stdout and a throughput summary to stderr.
+Returns the process exit code. */
+int batchRate(const BatchOptions& options);
+
+/* Parses every .sm file below options.root, in parallel, and writes them all
+into one chart cache at options.cache, so later batches can rate the pack
+from there without parsing it again. If options.cache already holds a
+cache, it is updated instead: the files are only stat'ed, and only new ones
+and ones whose size or modification time changed are read and parsed (or,
+if their content hash didn't change, just restamped). Files that are gone
+drop out. Returns the process exit code. */
+int batchConvert(const BatchOptions& options);
+
+#endif //MINACALC_BATCH_H
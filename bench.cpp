@@ -0,0 +1,314 @@
+#include "alloccounter.h"
+#include "calcsession.h"
+#include "chartgen.h"
+#include "minacalc.h"
+#include "smloader.h"
+#include "solocalc.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+/* minacalc_bench [--patterns stream,jumpstream,...] [--lengths 30,120,600]
+                  [--seed N] [--repeats N] [--out file.json]
+
+Times the loader and each stage of the calc on generated charts (see
+chartgen.h) and writes the timings as JSON, to stdout unless --out is given.
+Everything runs on the calling thread, one chart at a time. Each stage is
+timed `repeats` times and reported as the min, median and mean in ms; the
+ratings are included too, so a run that got faster by changing the results
+stands out, and so are the heap allocations of one MinaSDCalc call in a new
+CalcWorkspace, in the thread's own and in a warmed up one. */
+
+namespace {
+
+struct BenchOptions {
+    vector<ChartPattern> patterns;
+    vector<float> lengths;
+    uint64_t seed = 1;
+    int repeats = 5;
+    string out;
+};
+
+struct Timing {
+    string name;
+    vector<double> ms;
+};
+
+// Keeps the compiler from dropping calls whose results aren't used
+volatile float sink;
+
+template <typename F>
+Timing time_stage(const string& name, int repeats, F&& stage) {
+    Timing timing{name, {}};
+    for (int i = 0; i < repeats; i++) {
+        auto start = std::chrono::steady_clock::now();
+        stage();
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        timing.ms.push_back(elapsed.count());
+    }
+    return timing;
+}
+
+bool split_list(const string& list, vector<string>& items) {
+    std::stringstream stream(list);
+    string item;
+    while (std::getline(stream, item, ','))
+        if (!item.empty())
+            items.push_back(item);
+    return !items.empty();
+}
+
+bool parse_options(int argc, char* argv[], BenchOptions& options) {
+    string patterns = "stream,jumpstream,handstream,chordjack,minijacks,rolls,stamina";
+    string lengths = "30,120,600";
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--patterns") == 0 && has_value)
+            patterns = argv[++i];
+        else if (strcmp(argv[i], "--lengths") == 0 && has_value)
+            lengths = argv[++i];
+        else if (strcmp(argv[i], "--seed") == 0 && has_value)
+            options.seed = std::strtoull(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--repeats") == 0 && has_value)
+            options.repeats = std::max(1, std::atoi(argv[++i]));
+        else if (strcmp(argv[i], "--out") == 0 && has_value)
+            options.out = argv[++i];
+        else {
+            std::cerr << "unexpected argument " << argv[i] << '\n';
+            return false;
+        }
+    }
+
+    vector<string> items;
+    if (!split_list(patterns, items))
+        return false;
+    for (const string& item : items) {
+        ChartPattern pattern;
+        if (!parse_pattern(item, pattern)) {
+            std::cerr << "unknown pattern " << item << '\n';
+            return false;
+        }
+        options.patterns.push_back(pattern);
+    }
+    items.clear();
+    if (!split_list(lengths, items))
+        return false;
+    for (const string& item : items) {
+        float seconds = std::strtof(item.c_str(), nullptr);
+        if (!(seconds > 0.f)) {
+            std::cerr << "bad length " << item << '\n';
+            return false;
+        }
+        options.lengths.push_back(seconds);
+    }
+    return true;
+}
+
+void write_rating(std::ostream& out, const DifficultyRating& r) {
+    out << "{\"overall\": " << r.overall << ", \"stream\": " << r.stream
+        << ", \"jumpstream\": " << r.jumpstream << ", \"handstream\": " << r.handstream
+        << ", \"stamina\": " << r.stamina << ", \"jack\": " << r.jack
+        << ", \"chordjack\": " << r.chordjack << ", \"technical\": " << r.technical << "}";
+}
+
+void write_timing(std::ostream& out, const Timing& timing) {
+    vector<double> sorted = timing.ms;
+    std::sort(sorted.begin(), sorted.end());
+    double total = 0;
+    for (double ms : sorted)
+        total += ms;
+    size_t n = sorted.size();
+    double median = n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+    out << "\"" << timing.name << "\": {\"min_ms\": " << sorted.front() << ", \"median_ms\": " << median
+        << ", \"mean_ms\": " << total / n << "}";
+}
+
+// Benchmarks one generated chart and writes its JSON object
+bool bench_chart(std::ostream& out, ChartPattern pattern, float seconds, const BenchOptions& options) {
+    ChartGenOptions generate;
+    generate.pattern = pattern;
+    generate.seconds = seconds;
+    generate.seed = options.seed;
+    string sm = generate_sm(generate);
+
+    // load_from_file is timed on a real file, so the read is part of it
+    std::filesystem::path sm_path = std::filesystem::temp_directory_path() /
+        ("minacalc_bench_" + string(pattern_name(pattern)) + "_" + std::to_string(options.seed) + ".sm");
+    {
+        std::ofstream sm_file(sm_path, std::ios::binary | std::ios::trunc);
+        sm_file << sm;
+        if (!sm_file) {
+            std::cerr << "failed to write " << sm_path.string() << '\n';
+            return false;
+        }
+    }
+
+    SMNotes charts;
+    vector<Timing> timings;
+    timings.push_back(time_stage("load_from_file", options.repeats, [&] {
+        std::ifstream sm_file(sm_path);
+        charts = load_from_file(sm_file);
+    }));
+    std::error_code error;
+    std::filesystem::remove(sm_path, error);
+    if (charts.size() != 1 || charts[0].notes.empty()) {
+        std::cerr << "generated chart didn't load\n";
+        return false;
+    }
+    const vector<NoteInfo>& notes = charts[0].notes;
+    const float rate = 1.f;
+    const float goal = 0.93f;
+
+    PreparedChart prepared(notes);
+    timings.push_back(time_stage("PreparedChart", options.repeats, [&] {
+        PreparedChart chart(notes);
+        sink = chart.last_row_time;
+    }));
+    timings.push_back(time_stage("Calc::Init", options.repeats, [&] {
+        Calc calc;
+        calc.Init(prepared, rate);
+        sink = calc.MaxPoints;
+    }));
+
+    // The chisels as CalcMain runs them, on one initialised calc
+    Calc calc;
+    calc.Init(prepared, rate);
+    const ChiselType types[] = {STREAM, JS, HS, TECH, JACK};
+    const char* const type_names[] = {"Chisel STREAM", "Chisel JS", "Chisel HS", "Chisel TECH", "Chisel JACK"};
+    for (int i = 0; i < 5; i++)
+        timings.push_back(time_stage(type_names[i], options.repeats, [&] {
+            sink = calc.Chisel(0.1f, 10.24f, goal, types[i], false);
+        }));
+    float stream = calc.Chisel(0.1f, 10.24f, goal, STREAM, false);
+    timings.push_back(time_stage("Chisel stamina", options.repeats, [&] {
+        sink = calc.Chisel(stream - 0.1f, 2.56f, goal, STREAM, true);
+    }));
+
+    DifficultyRating rating{};
+    timings.push_back(time_stage("MinaSDCalc", options.repeats, [&] {
+        rating = MinaSDCalc(notes, rate, goal);
+    }));
+    CalcOptions sorted;
+    sorted.sorted_points = true;
+    timings.push_back(time_stage("MinaSDCalc sorted_points", options.repeats, [&] {
+        sink = MinaSDCalc(prepared, rate, goal, sorted).overall;
+    }));
+    CalcWorkspace workspace;
+    timings.push_back(time_stage("MinaSDCalc workspace", options.repeats, [&] {
+        sink = MinaSDCalc(notes, rate, goal, workspace).overall;
+    }));
+    // Heap allocations of one call in a new workspace, in the thread's one
+    // and in a warmed up one of the caller's
+    unsigned long long before = thread_allocations();
+    {
+        auto fresh = std::make_unique<CalcWorkspace>();
+        sink = MinaSDCalc(notes, rate, goal, *fresh).overall;
+    }
+    unsigned long long fresh_allocations = thread_allocations() - before;
+    before = thread_allocations();
+    sink = MinaSDCalc(prepared, rate, goal).overall;
+    unsigned long long thread_workspace_allocations = thread_allocations() - before;
+    before = thread_allocations();
+    sink = MinaSDCalc(notes, rate, goal, workspace).overall;
+    unsigned long long workspace_allocations = thread_allocations() - before;
+    timings.push_back(time_stage("MinaSDCalc all rates", options.repeats, [&] {
+        MinaSD ratings = MinaSDCalc(notes);
+        sink = ratings.back().overall;
+    }));
+    vector<float> goals;
+    for (int percent = 80; percent < 100; percent++)
+        goals.push_back(static_cast<float>(percent) / 100.f);
+    timings.push_back(time_stage("MinaSDCalc goals 0.80-0.99", options.repeats, [&] {
+        vector<DifficultyRating> ratings = MinaSDCalc(prepared, rate, goals);
+        sink = ratings.back().overall;
+    }));
+    float solo = 0.f;
+    timings.push_back(time_stage("soloCalc", options.repeats, [&] {
+        solo = soloCalc(notes, rate, goal);
+    }));
+    // Taking a row out of the middle, or near the end, or putting it back,
+    // then rating
+    CalcSession session(rate, goal);
+    session.Reset(notes);
+    session.Rate();
+    for (size_t at : {notes.size() / 2, notes.size() - std::min<size_t>(notes.size(), 10)}) {
+        const NoteInfo edited = notes[at];
+        bool removed = false;
+        timings.push_back(time_stage(at == notes.size() / 2 ? "CalcSession edit" : "CalcSession edit near the end",
+                                     options.repeats, [&] {
+            if (removed)
+                session.InsertRow(edited);
+            else
+                session.RemoveRow(edited.rowTime);
+            removed = !removed;
+            sink = session.Rate().overall;
+        }));
+        if (removed)
+            session.InsertRow(edited);
+    }
+
+    size_t taps = 0;
+    for (size_t column_taps : prepared.column_taps)
+        taps += column_taps;
+    out << "    {\"pattern\": \"" << pattern_name(pattern) << "\", \"seconds\": " << seconds
+        << ", \"bytes\": " << sm.size() << ", \"rows\": " << notes.size() << ", \"taps\": " << taps
+        << ",\n     \"rating\": ";
+    write_rating(out, rating);
+    out << ", \"solo\": " << solo << ",\n     \"allocations\": {\"MinaSDCalc new workspace\": " << fresh_allocations
+        << ", \"MinaSDCalc\": " << thread_workspace_allocations << ", \"MinaSDCalc workspace\": "
+        << workspace_allocations << "},\n     \"timings\": {";
+    for (size_t i = 0; i < timings.size(); i++) {
+        out << (i ? ",\n                 " : "");
+        write_timing(out, timings[i]);
+    }
+    out << "}}";
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    if (!parse_options(argc, argv, options)) {
+        std::cerr << "usage: minacalc_bench [--patterns stream,jumpstream,...] [--lengths 30,120,600]"
+                     " [--seed N] [--repeats N] [--out file.json]\n";
+        return 1;
+    }
+
+    std::ofstream out_file;
+    if (!options.out.empty()) {
+        out_file.open(options.out, std::ios::trunc);
+        if (!out_file) {
+            std::cerr << "failed to open " << options.out << '\n';
+            return 1;
+        }
+    }
+    std::ostream& out = options.out.empty() ? std::cout : out_file;
+    out.precision(9);
+
+    out << "{\"calc_version\": " << GetCalcVersion() << ", \"seed\": " << options.seed
+        << ", \"repeats\": " << options.repeats << ",\n \"charts\": [\n";
+    bool first = true;
+    for (ChartPattern pattern : options.patterns)
+        for (float seconds : options.lengths) {
+            std::cerr << pattern_name(pattern) << ' ' << seconds << "s\n";
+            if (!first)
+                out << ",\n";
+            first = false;
+            if (!bench_chart(out, pattern, seconds, options))
+                return 1;
+        }
+    out << "\n]}\n";
+    return out ? 0 : 1;
+}
@@ -0,0 +1,553 @@
+#include "calckernels.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CALCKERNELS_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CALCKERNELS_SSE2
+#endif
+#endif
+
+// Lets GCC and Clang compile single functions for newer instruction sets
+// than the rest of the build. FMA is deliberately left out so the AVX2
+// code rounds exactly like the SSE2 and scalar versions.
+#if defined(CALCKERNELS_X86) && defined(__GNUC__)
+#define KERNEL_TARGET(isa) __attribute__((target(isa)))
+#else
+#define KERNEL_TARGET(isa)
+#endif
+
+float ExpectedPoints(float skill, const float* diff, const int* points, size_t n, float total) {
+    float total_achieved_points = total;
+    for (size_t i = 0; i < n; i++) {
+        float achieved_points = points[i];
+        if (skill <= diff[i])
+            achieved_points *= std::pow(skill / diff[i], 1.8f);
+        total_achieved_points += achieved_points;
+    }
+    return total_achieved_points;
+}
+
+#ifdef CALCKERNELS_SSE2
+
+// The skills four to a vector against one difficulty at a time: the
+// divisions, comparisons, products and sums each in one vector operation,
+// which round like the scalar ones; the pows that are needed are done one
+// by one with std::pow. Padding lanes are computed too and dropped.
+void ExpectedPointsMulti(const float* skills, size_t count, const float* diff, const int* points, size_t n,
+                         float* totals) {
+    const size_t max_groups = 2; // MAX_PROBES skills
+    float padded[4 * max_groups];
+    for (size_t k = 0; k < 4 * max_groups; k++)
+        padded[k] = skills[k < count ? k : 0];
+    size_t groups = (count + 3) / 4;
+    __m128 skill[max_groups];
+    __m128 group_totals[max_groups];
+    int used[max_groups];
+    for (size_t g = 0; g < groups; g++) {
+        skill[g] = _mm_loadu_ps(padded + 4 * g);
+        group_totals[g] = _mm_setzero_ps();
+        used[g] = count - 4 * g >= 4 ? 15 : (1 << (count - 4 * g)) - 1;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        const __m128 interval_diff = _mm_set1_ps(diff[i]);
+        const __m128 interval_points = _mm_set1_ps(static_cast<float>(points[i]));
+        for (size_t g = 0; g < groups; g++) {
+            __m128 achieved_points = interval_points;
+            int scaled = _mm_movemask_ps(_mm_cmple_ps(skill[g], interval_diff)) & used[g];
+            if (scaled) {
+                float ratios[4];
+                _mm_storeu_ps(ratios, _mm_div_ps(skill[g], interval_diff));
+                float factors[4] = {1.f, 1.f, 1.f, 1.f};
+                for (int t = 0; t < 4; t++)
+                    if (scaled & (1 << t))
+                        factors[t] = std::pow(ratios[t], 1.8f);
+                achieved_points = _mm_mul_ps(achieved_points, _mm_loadu_ps(factors));
+            }
+            group_totals[g] = _mm_add_ps(group_totals[g], achieved_points);
+        }
+    }
+    for (size_t g = 0; g < groups; g++) {
+        float sums[4];
+        _mm_storeu_ps(sums, group_totals[g]);
+        for (size_t k = 4 * g; k < count && k < 4 * g + 4; k++)
+            totals[k] = sums[k - 4 * g];
+    }
+}
+
+#else
+
+void ExpectedPointsMulti(const float* skills, size_t count, const float* diff, const int* points, size_t n,
+                         float* totals) {
+    for (size_t k = 0; k < count; k++)
+        totals[k] = 0.f;
+    for (size_t i = 0; i < n; i++) {
+        for (size_t k = 0; k < count; k++) {
+            float achieved_points = points[i];
+            if (skills[k] <= diff[i])
+                achieved_points *= std::pow(skills[k] / diff[i], 1.8f);
+            totals[k] += achieved_points;
+        }
+    }
+}
+
+#endif
+
+namespace {
+
+/* x^1.8 for x in (0, 1] as 2^(1.8 * log2(x)).
+
+log2: split x into 2^e * m with m in [sqrt(0.5), sqrt(2)), then
+log2(m) = 2/ln(2) * atanh(t) with t = (m - 1) / (m + 1), |t| <= 0.172, using
+the atanh series up to t^9 (truncation error < 4e-10).
+
+exp2: split y into n + f with n integral and |f| <= 0.5, then 2^f from its
+Taylor series up to f^7 (truncation error < 3e-9) and 2^n from the float
+exponent bits. y is clamped to [-126, 0], below which the points are 0
+anyway.
+
+Every variant below does exactly these operations in this order. */
+const float sqrt2 = 1.41421356f;
+const float log2_c1 = 2.88539008f; // 2/ln(2)
+const float log2_c3 = 0.961796694f; // 2/(3 ln(2))
+const float log2_c5 = 0.577078016f;
+const float log2_c7 = 0.412198583f;
+const float log2_c9 = 0.320598898f;
+const float exp2_c1 = 0.693147181f; // ln(2)
+const float exp2_c2 = 0.240226507f; // ln(2)^2/2!
+const float exp2_c3 = 0.0555041087f;
+const float exp2_c4 = 0.00961812911f;
+const float exp2_c5 = 0.00133335581f;
+const float exp2_c6 = 0.000154035304f;
+const float exp2_c7 = 0.0000152527338f;
+const float round_magic = 12582912.f; // 1.5 * 2^23, rounds to integer when added
+
+inline float bits_to_float(int32_t i) {
+    float f;
+    memcpy(&f, &i, sizeof(f));
+    return f;
+}
+
+inline int32_t float_to_bits(float f) {
+    int32_t i;
+    memcpy(&i, &f, sizeof(i));
+    return i;
+}
+
+inline float pow18_scalar(float x) {
+    int32_t bits = float_to_bits(x);
+    float e = static_cast<float>(((bits >> 23) & 0xff) - 127);
+    float m = bits_to_float((bits & 0x007fffff) | 0x3f800000);
+    if (m > sqrt2) {
+        m = m * 0.5f;
+        e = e + 1.f;
+    }
+    float t = (m - 1.f) / (m + 1.f);
+    float t2 = t * t;
+    float log2m = t * (log2_c1 + t2 * (log2_c3 + t2 * (log2_c5 + t2 * (log2_c7 + t2 * log2_c9))));
+    float y = 1.8f * (e + log2m);
+    y = y < -126.f ? -126.f : y;
+    y = y > 0.f ? 0.f : y;
+
+    float rounded = (y + round_magic) - round_magic;
+    float f = y - rounded;
+    float p = 1.f + f * (exp2_c1 + f * (exp2_c2 + f * (exp2_c3 + f * (exp2_c4 + f * (exp2_c5 + f * (exp2_c6 + f * exp2_c7))))));
+    float scale = bits_to_float((static_cast<int32_t>(rounded) + 127) << 23);
+    return p * scale;
+}
+
+inline float fast_term(float skill, float diff, int points) {
+    float achieved_points = static_cast<float>(points);
+    float multiplier = skill > diff ? 1.f : pow18_scalar(skill / diff);
+    return achieved_points * multiplier;
+}
+
+// All variants keep 8 partial sums, lane i taking intervals i, i + 8, ...,
+// and add them up in this order
+inline float reduce_lanes(const float* lanes) {
+    return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+}
+
+// Continues lane accumulation for the intervals after the last full block
+inline void tail_lanes(float skill, const float* diff, const int* points, size_t start, size_t n, float* lanes) {
+    for (size_t i = start; i < n; i++)
+        lanes[i - start] += fast_term(skill, diff[i], points[i]);
+}
+
+float expected_points_scalar(float skill, const float* diff, const int* points, size_t n) {
+    float lanes[8] = {0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f};
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+        for (size_t l = 0; l < 8; l++)
+            lanes[l] += fast_term(skill, diff[i + l], points[i + l]);
+    tail_lanes(skill, diff, points, i, n, lanes);
+    return reduce_lanes(lanes);
+}
+
+#ifdef CALCKERNELS_SSE2
+
+// SSE2 is part of x86-64, so this needs no target attribute there
+inline __m128 pow18_sse2(__m128 x) {
+    const __m128i bits = _mm_castps_si128(x);
+    __m128 e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_and_si128(_mm_srli_epi32(bits, 23), _mm_set1_epi32(0xff)), _mm_set1_epi32(127)));
+    __m128 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007fffff)), _mm_set1_epi32(0x3f800000)));
+    __m128 big = _mm_cmpgt_ps(m, _mm_set1_ps(sqrt2));
+    m = _mm_or_ps(_mm_and_ps(big, _mm_mul_ps(m, _mm_set1_ps(0.5f))), _mm_andnot_ps(big, m));
+    e = _mm_or_ps(_mm_and_ps(big, _mm_add_ps(e, _mm_set1_ps(1.f))), _mm_andnot_ps(big, e));
+
+    const __m128 one = _mm_set1_ps(1.f);
+    __m128 t = _mm_div_ps(_mm_sub_ps(m, one), _mm_add_ps(m, one));
+    __m128 t2 = _mm_mul_ps(t, t);
+    __m128 poly = _mm_add_ps(_mm_set1_ps(log2_c7), _mm_mul_ps(t2, _mm_set1_ps(log2_c9)));
+    poly = _mm_add_ps(_mm_set1_ps(log2_c5), _mm_mul_ps(t2, poly));
+    poly = _mm_add_ps(_mm_set1_ps(log2_c3), _mm_mul_ps(t2, poly));
+    poly = _mm_add_ps(_mm_set1_ps(log2_c1), _mm_mul_ps(t2, poly));
+    __m128 y = _mm_mul_ps(_mm_set1_ps(1.8f), _mm_add_ps(e, _mm_mul_ps(t, poly)));
+    y = _mm_min_ps(_mm_max_ps(y, _mm_set1_ps(-126.f)), _mm_setzero_ps());
+
+    const __m128 magic = _mm_set1_ps(round_magic);
+    __m128 rounded = _mm_sub_ps(_mm_add_ps(y, magic), magic);
+    __m128 f = _mm_sub_ps(y, rounded);
+    __m128 p = _mm_add_ps(_mm_set1_ps(exp2_c6), _mm_mul_ps(f, _mm_set1_ps(exp2_c7)));
+    p = _mm_add_ps(_mm_set1_ps(exp2_c5), _mm_mul_ps(f, p));
+    p = _mm_add_ps(_mm_set1_ps(exp2_c4), _mm_mul_ps(f, p));
+    p = _mm_add_ps(_mm_set1_ps(exp2_c3), _mm_mul_ps(f, p));
+    p = _mm_add_ps(_mm_set1_ps(exp2_c2), _mm_mul_ps(f, p));
+    p = _mm_add_ps(_mm_set1_ps(exp2_c1), _mm_mul_ps(f, p));
+    p = _mm_add_ps(one, _mm_mul_ps(f, p));
+    __m128 scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(rounded), _mm_set1_epi32(127)), 23));
+    return _mm_mul_ps(p, scale);
+}
+
+inline __m128 fast_terms_sse2(__m128 skill, const float* diff, const int* points) {
+    __m128 d = _mm_loadu_ps(diff);
+    __m128 achieved_points = _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(points)));
+    __m128 full = _mm_cmpgt_ps(skill, d);
+    __m128 scaled = pow18_sse2(_mm_div_ps(skill, d));
+    __m128 multiplier = _mm_or_ps(_mm_and_ps(full, _mm_set1_ps(1.f)), _mm_andnot_ps(full, scaled));
+    return _mm_mul_ps(achieved_points, multiplier);
+}
+
+float expected_points_sse2(float skill, const float* diff, const int* points, size_t n) {
+    __m128 s = _mm_set1_ps(skill);
+    __m128 lo = _mm_setzero_ps(); // lanes 0-3
+    __m128 hi = _mm_setzero_ps(); // lanes 4-7
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        lo = _mm_add_ps(lo, fast_terms_sse2(s, diff + i, points + i));
+        hi = _mm_add_ps(hi, fast_terms_sse2(s, diff + i + 4, points + i + 4));
+    }
+    float lanes[8];
+    _mm_storeu_ps(lanes, lo);
+    _mm_storeu_ps(lanes + 4, hi);
+    tail_lanes(skill, diff, points, i, n, lanes);
+    return reduce_lanes(lanes);
+}
+
+#endif // CALCKERNELS_SSE2
+
+#ifdef CALCKERNELS_X86
+
+KERNEL_TARGET("avx2")
+inline __m256 pow18_avx2(__m256 x) {
+    const __m256i bits = _mm256_castps_si256(x);
+    __m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_and_si256(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(0xff)), _mm256_set1_epi32(127)));
+    __m256 m = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007fffff)), _mm256_set1_epi32(0x3f800000)));
+    __m256 big = _mm256_cmp_ps(m, _mm256_set1_ps(sqrt2), _CMP_GT_OQ);
+    m = _mm256_blendv_ps(m, _mm256_mul_ps(m, _mm256_set1_ps(0.5f)), big);
+    e = _mm256_blendv_ps(e, _mm256_add_ps(e, _mm256_set1_ps(1.f)), big);
+
+    const __m256 one = _mm256_set1_ps(1.f);
+    __m256 t = _mm256_div_ps(_mm256_sub_ps(m, one), _mm256_add_ps(m, one));
+    __m256 t2 = _mm256_mul_ps(t, t);
+    __m256 poly = _mm256_add_ps(_mm256_set1_ps(log2_c7), _mm256_mul_ps(t2, _mm256_set1_ps(log2_c9)));
+    poly = _mm256_add_ps(_mm256_set1_ps(log2_c5), _mm256_mul_ps(t2, poly));
+    poly = _mm256_add_ps(_mm256_set1_ps(log2_c3), _mm256_mul_ps(t2, poly));
+    poly = _mm256_add_ps(_mm256_set1_ps(log2_c1), _mm256_mul_ps(t2, poly));
+    __m256 y = _mm256_mul_ps(_mm256_set1_ps(1.8f), _mm256_add_ps(e, _mm256_mul_ps(t, poly)));
+    y = _mm256_min_ps(_mm256_max_ps(y, _mm256_set1_ps(-126.f)), _mm256_setzero_ps());
+
+    const __m256 magic = _mm256_set1_ps(round_magic);
+    __m256 rounded = _mm256_sub_ps(_mm256_add_ps(y, magic), magic);
+    __m256 f = _mm256_sub_ps(y, rounded);
+    __m256 p = _mm256_add_ps(_mm256_set1_ps(exp2_c6), _mm256_mul_ps(f, _mm256_set1_ps(exp2_c7)));
+    p = _mm256_add_ps(_mm256_set1_ps(exp2_c5), _mm256_mul_ps(f, p));
+    p = _mm256_add_ps(_mm256_set1_ps(exp2_c4), _mm256_mul_ps(f, p));
+    p = _mm256_add_ps(_mm256_set1_ps(exp2_c3), _mm256_mul_ps(f, p));
+    p = _mm256_add_ps(_mm256_set1_ps(exp2_c2), _mm256_mul_ps(f, p));
+    p = _mm256_add_ps(_mm256_set1_ps(exp2_c1), _mm256_mul_ps(f, p));
+    p = _mm256_add_ps(one, _mm256_mul_ps(f, p));
+    __m256 scale = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(rounded), _mm256_set1_epi32(127)), 23));
+    return _mm256_mul_ps(p, scale);
+}
+
+KERNEL_TARGET("avx2")
+float expected_points_avx2(float skill, const float* diff, const int* points, size_t n) {
+    __m256 s = _mm256_set1_ps(skill);
+    __m256 acc = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 d = _mm256_loadu_ps(diff + i);
+        __m256 achieved_points = _mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(points + i)));
+        __m256 full = _mm256_cmp_ps(s, d, _CMP_GT_OQ);
+        __m256 scaled = pow18_avx2(_mm256_div_ps(s, d));
+        __m256 multiplier = _mm256_blendv_ps(scaled, _mm256_set1_ps(1.f), full);
+        acc = _mm256_add_ps(acc, _mm256_mul_ps(achieved_points, multiplier));
+    }
+    float lanes[8];
+    _mm256_storeu_ps(lanes, acc);
+    tail_lanes(skill, diff, points, i, n, lanes);
+    return reduce_lanes(lanes);
+}
+
+bool cpu_has_avx2() {
+#if defined(__GNUC__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    // The OS has to save the upper halves of the ymm registers
+    if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return false;
+#endif
+}
+
+#endif // CALCKERNELS_X86
+
+typedef float (*ExpectedPointsKernel)(float, const float*, const int*, size_t);
+
+struct Dispatch {
+    ExpectedPointsKernel expected_points;
+    const char* name;
+};
+
+Dispatch pick_kernel() {
+#ifdef CALCKERNELS_X86
+    if (cpu_has_avx2())
+        return Dispatch {expected_points_avx2, "avx2"};
+#endif
+#ifdef CALCKERNELS_SSE2
+    return Dispatch {expected_points_sse2, "sse2"};
+#endif
+    return Dispatch {expected_points_scalar, "scalar"};
+}
+
+const Dispatch& dispatch() {
+    static const Dispatch picked = pick_kernel();
+    return picked;
+}
+
+} // namespace
+
+float ExpectedPointsFast(float skill, const float* diff, const int* points, size_t n) {
+    // The approximation only covers ratios in (0, 1]
+    if (!(skill > 0.f))
+        return ExpectedPoints(skill, diff, points, n);
+    return dispatch().expected_points(skill, diff, points, n);
+}
+
+const char* FastKernelName() {
+    return dispatch().name;
+}
+
+namespace {
+
+const float jack_base_ceiling = 1.15f; // Jack multiplier max
+const float jack_fscale = 1750.f; // How fast ceiling rises
+const float jack_prop = 0.75f; // Proportion of player difficulty at which jack tax begins
+const float jack_mag = 250.f; // Jack diff multiplier
+
+// What a note the player's skill is below loses, given its jack difficulty
+// with the multiplier applied
+inline float jack_note_loss(float skill, float jd) {
+    // This can cause output to decrease if 0.96 * i < x < i
+    return 1.f - std::pow(skill / (jd * 0.96f), 1.5f);
+}
+
+inline float jack_total_loss(float output) {
+    float loss = 7.f * output;
+    return loss > 10000.f ? 10000.f : (loss < 0.f ? 0.f : loss);
+}
+
+} // namespace
+
+void JackWalkOn(float skill, const float* jack_diffs, size_t n, size_t stride, JackWalk& walk) {
+    float output = walk.output;
+    float ceiling = walk.ceiling;
+    float mod = walk.mod;
+
+    for (size_t i = 0; i < n; i++) { // Iterate interval's jack difficulties
+        float jd = jack_diffs[i * stride];
+        // Decrease if jack difficulty is over 133% of player skill
+        mod += ((jd / (jack_prop * skill)) - 1) / jack_mag;
+
+        if (mod > 1.f)
+            ceiling += (mod - 1) / jack_fscale;
+
+        float high = jack_base_ceiling * std::sqrt(ceiling);
+        mod = mod > high ? high : (mod < 1.f ? 1.f : mod);
+
+        jd *= mod;
+
+        if (skill < jd) // If player skill below jack diffiulty
+            output += jack_note_loss(skill, jd);
+    }
+
+    walk.output = output;
+    walk.ceiling = ceiling;
+    walk.mod = mod;
+}
+
+float JackWalkLoss(const JackWalk& walk) {
+    return jack_total_loss(walk.output);
+}
+
+float JackLoss(float skill, const float* jack_diffs, size_t n, size_t stride) {
+    JackWalk walk;
+    JackWalkOn(skill, jack_diffs, n, stride, walk);
+    return JackWalkLoss(walk);
+}
+
+#ifdef CALCKERNELS_SSE2
+
+/* The same operations as JackLoss, on four lanes. The clamp maps exactly:
+max(1, mod) is mod < 1 ? 1 : mod (NaN stays), and since the ceiling never
+drops below 1, min(high, that) is mod > high ? high : it. Adding a masked
+out increment adds +0, which leaves the ceiling as it is. */
+void JackLosses(float skill, const float* lanes, const size_t lengths[4], float losses[4]) {
+    size_t rows = 0;
+    size_t common = lengths[0];
+    for (int c = 0; c < 4; c++) {
+        rows = lengths[c] > rows ? lengths[c] : rows;
+        common = lengths[c] < common ? lengths[c] : common;
+    }
+
+    const __m128 one = _mm_set1_ps(1.f);
+    const __m128 prop_skill = _mm_set1_ps(jack_prop * skill);
+    const __m128 mag = _mm_set1_ps(jack_mag);
+    const __m128 fscale = _mm_set1_ps(jack_fscale);
+    const __m128 base_ceiling = _mm_set1_ps(jack_base_ceiling);
+    const __m128 skills = _mm_set1_ps(skill);
+    __m128 mod = one;
+    __m128 ceiling = one;
+    float output[4] = {0.f, 0.f, 0.f, 0.f};
+
+    for (size_t k = 0; k < rows; k++) {
+        __m128 jd = _mm_loadu_ps(lanes + 4 * k);
+        mod = _mm_add_ps(mod, _mm_div_ps(_mm_sub_ps(_mm_div_ps(jd, prop_skill), one), mag));
+        __m128 rising = _mm_and_ps(_mm_cmpgt_ps(mod, one), _mm_div_ps(_mm_sub_ps(mod, one), fscale));
+        ceiling = _mm_add_ps(ceiling, rising);
+        __m128 high = _mm_mul_ps(base_ceiling, _mm_sqrt_ps(ceiling));
+        mod = _mm_min_ps(high, _mm_max_ps(one, mod));
+        jd = _mm_mul_ps(jd, mod);
+
+        int losing = _mm_movemask_ps(_mm_cmplt_ps(skills, jd));
+        if (k >= common)
+            for (int c = 0; c < 4; c++)
+                if (k >= lengths[c])
+                    losing &= ~(1 << c);
+        if (losing) {
+            float scaled[4];
+            _mm_storeu_ps(scaled, jd);
+            for (int c = 0; c < 4; c++)
+                if (losing & (1 << c))
+                    output[c] += jack_note_loss(skill, scaled[c]);
+        }
+    }
+
+    for (int c = 0; c < 4; c++)
+        losses[c] = jack_total_loss(output[c]);
+}
+
+#else
+
+void JackLosses(float skill, const float* lanes, const size_t lengths[4], float losses[4]) {
+    for (int c = 0; c < 4; c++)
+        losses[c] = JackLoss(skill, lanes + c, lengths[c], 4);
+}
+
+#endif
+
+namespace {
+
+double scaled_term(const std::pair<float, int>& interval) {
+    return interval.second * std::pow(static_cast<double>(interval.first), -1.8);
+}
+
+} // namespace
+
+void SortedPoints::Assign(const float* diff, const int* points, size_t n) {
+    // Intervals without points add nothing for skills > 0
+    intervals.clear();
+    for (size_t i = 0; i < n; i++)
+        if (points[i] != 0)
+            intervals.emplace_back(diff[i], points[i]);
+    std::sort(intervals.begin(), intervals.end());
+
+    terms.resize(intervals.size());
+    for (size_t i = 0; i < intervals.size(); i++)
+        terms[i] = scaled_term(intervals[i]);
+    Sum();
+}
+
+void SortedPoints::Replace(const float* old_diff, const int* old_points, size_t old_count, const float* diff,
+                           const int* points, size_t count) {
+    for (size_t j = 0; j < old_count; j++) {
+        if (old_points[j] == 0)
+            continue;
+        auto found = std::lower_bound(intervals.begin(), intervals.end(), std::make_pair(old_diff[j], old_points[j]));
+        terms.erase(terms.begin() + (found - intervals.begin()));
+        intervals.erase(found);
+    }
+    // Equal pairs give equal terms, so where among them doesn't matter
+    for (size_t j = 0; j < count; j++) {
+        if (points[j] == 0)
+            continue;
+        std::pair<float, int> interval(diff[j], points[j]);
+        auto at = std::upper_bound(intervals.begin(), intervals.end(), interval);
+        terms.insert(terms.begin() + (at - intervals.begin()), scaled_term(interval));
+        intervals.insert(at, interval);
+    }
+    Sum();
+}
+
+void SortedPoints::Sum() {
+    size_t m = intervals.size();
+    diffs.resize(m);
+    full_points.resize(m + 1);
+    scaled_points.resize(m + 1);
+    full_points[0] = 0.0;
+    for (size_t i = 0; i < m; i++) {
+        diffs[i] = intervals[i].first;
+        full_points[i + 1] = full_points[i] + intervals[i].second;
+    }
+    // From the top, so the diffs of 0 (which only come before any skill
+    // > 0) never get into the sums that are read
+    scaled_points[m] = 0.0;
+    for (size_t i = m; i-- > 0;)
+        scaled_points[i] = scaled_points[i + 1] + terms[i];
+}
+
+float SortedPoints::ExpectedPoints(float skill) const {
+    // The first interval with skill <= diff, like in ExpectedPoints
+    auto k = static_cast<size_t>(std::lower_bound(diffs.begin(), diffs.end(), skill) - diffs.begin());
+    return static_cast<float>(full_points[k] + std::pow(static_cast<double>(skill), 1.8) * scaled_points[k]);
+}
@@ -0,0 +1,110 @@
+#ifndef MINACALC_CALCKERNELS_H
+#define MINACALC_CALCKERNELS_H
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+/* The innermost loops of the calculator, shared by Hand and the solo calc.
+
+ExpectedPoints is the reference: for each interval, the player gets all of
+points[i] if skill > diff[i], and points[i] * (skill / diff[i])^1.8
+otherwise. The sum is returned, added in order onto `total`, so a sum split
+at any interval and carried on comes out the same. */
+float ExpectedPoints(float skill, const float* diff, const int* points, size_t n, float total = 0.f);
+
+/* ExpectedPoints for `count` skills (at most 8) in one pass over the
+intervals, into totals[0 .. count - 1]. With SSE2 the skills go four to a
+vector. Each total is exactly ExpectedPoints's. */
+void ExpectedPointsMulti(const float* skills, size_t count, const float* diff, const int* points, size_t n,
+                         float* totals);
+
+/* Same as ExpectedPoints, but with a polynomial approximation of pow
+instead of std::pow, vectorised with AVX2 or SSE2 depending on what the
+CPU supports (picked once at runtime), with a scalar fallback everywhere
+else. Every variant does the same float operations and accumulates in
+the same 8 lanes, so the result doesn't depend on which one runs.
+
+Accuracy: each (skill / diff)^1.8 term is within 5e-7 relative error of
+std::pow for skill / diff >= 0.1 and within 4e-6 down to 1e-6 (rounding
+1.8 * log2 in float dominates there); below ~1e-21 it's clamped to 2^-126.
+The sums also differ from ExpectedPoints by float rounding from the
+different summation order. That can flip a chisel probe that lands right
+on the score goal, which moves that skillset by at most one step of the
+search's final resolution (0.08 for the skillsets, 0.02 for stamina)
+before the usual scaling. Over our test packs at every rate and at goals
+of 80%, 93% and 96.5%, no rating changed. Skills <= 0, which the searches
+do probe, go through the reference path. */
+float ExpectedPointsFast(float skill, const float* diff, const int* points, size_t n);
+
+// "avx2", "sse2" or "scalar"
+const char* FastKernelName();
+
+/* The points a player with `skill` loses on the local jack difficulties of
+one column, n of them `stride` floats apart. The jack multiplier and its
+ceiling carry over from one note to the next, so this is one serial walk. */
+float JackLoss(float skill, const float* jack_diffs, size_t n, size_t stride = 1);
+
+// Where JackLoss's walk is after some notes
+struct JackWalk {
+    float output = 0.f;
+    float ceiling = 1.f;
+    float mod = 1.f;
+};
+
+/* JackLoss in parts: walks on from `walk` over the next n notes. A walk
+from JackWalk() over all of them, in any number of parts, ends where
+JackLoss's does, and JackWalkLoss of it is JackLoss's result. */
+void JackWalkOn(float skill, const float* jack_diffs, size_t n, size_t stride, JackWalk& walk);
+float JackWalkLoss(const JackWalk& walk);
+
+/* JackLoss of four columns at once, walked in lockstep: with SSE2 the
+multiplier updates of all four run in one vector, and only the pow of the
+notes that lose points is done per column. `lanes` holds the columns
+interleaved, lanes[4 * k + c] being note k of column c, for as many k as the
+longest column has notes; past its length a column's lane is ignored. The
+results are exactly JackLoss's. */
+void JackLosses(float skill, const float* lanes, const size_t lengths[4], float losses[4]);
+
+/* ExpectedPoints of the same intervals for many skills, in O(log n) per skill
+after an O(n log n) Assign. With the diffs sorted, the intervals below the
+skill give all their points and the rest give
+skill^1.8 * points[i] * diff[i]^-1.8, so the total is a prefix sum of the
+points plus skill^1.8 times a suffix sum of the scaled points, split at a
+binary search for the skill.
+
+Only the same as ExpectedPoints up to rounding: the terms are summed in
+double, in diff order, and the pow is split in two. Like with
+ExpectedPointsFast, that can move a chisel by one step of its final
+resolution. Only for skills > 0; the few smaller ones the searches probe
+are left to ExpectedPoints, which is what gives their NaNs and infs. */
+class SortedPoints
+{
+public:
+    // Keeps no pointers to the arrays; reuses its memory on every call
+    void Assign(const float* diff, const int* points, size_t n);
+    /* Swaps the old_count intervals old_diff/old_points, which have to be
+    among the assigned ones, for the count intervals diff/points, exactly
+    as if all of them had been assigned again. Finding them is O(log n)
+    each, only the new ones need a pow, and the sums are redone in O(n). */
+    void Replace(const float* old_diff, const int* old_points, size_t old_count, const float* diff,
+                 const int* points, size_t count);
+    // skill > 0
+    float ExpectedPoints(float skill) const;
+
+private:
+    // Redoes diffs and the sums from intervals and terms
+    void Sum();
+
+    // (diff, points) of the intervals with points, by diff
+    std::vector<std::pair<float, int>> intervals;
+    // points * diff^-1.8 of each of them, in double
+    std::vector<double> terms;
+    std::vector<float> diffs; // Ascending
+    // Over intervals 0 .. k - 1 for full_points[k], k .. end for
+    // scaled_points[k]
+    std::vector<double> full_points;
+    std::vector<double> scaled_points;
+};
+
+#endif //MINACALC_CALCKERNELS_H
@@ -0,0 +1,363 @@
+#include "calcsession.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iterator>
+
+using std::vector;
+
+namespace {
+
+// Smooth() and DifficultyMSSmooth() of minacalc.cpp, for one index of the
+// unsmoothed values
+float smoothed_at(const vector<float>& input, size_t i, float neutral) {
+    float f1 = i >= 2 ? input[i - 2] : neutral;
+    float f2 = i >= 1 ? input[i - 1] : neutral;
+    float f3 = input[i];
+    return (f1 + f2 + f3) / 3;
+}
+
+float ms_smoothed_at(const vector<float>& input, size_t i) {
+    float f1 = i >= 1 ? input[i - 1] : 0.f;
+    float f2 = input[i];
+    return (f1 + f2) / 2.f;
+}
+
+} // namespace
+
+CalcSession::CalcSession(float music_rate, float score_goal, const CalcOptions& options)
+    : music_rate(music_rate), score_goal(score_goal) {
+    calc.options = options;
+    calc.left_hand.fast_points = options.fast_points;
+    calc.right_hand.fast_points = options.fast_points;
+    calc.left_hand.sorted_points = options.sorted_points;
+    calc.right_hand.sorted_points = options.sorted_points;
+    calc.checkpoints = &checkpoints;
+}
+
+void CalcSession::Reset(const vector<NoteInfo>& rows) {
+    vector<NoteInfo> sorted;
+    sorted.reserve(rows.size());
+    for (const NoteInfo& row : rows)
+        if (row.notes != 0)
+            sorted.push_back(row);
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [](const NoteInfo& a, const NoteInfo& b) { return a.rowTime < b.rowTime; });
+
+    chart = PreparedChart(sorted);
+    for (vector<float>& times : column_times)
+        times.clear();
+    for (const NoteInfo& row : sorted)
+        for (int t = 0; t < 4; t++)
+            if (row.notes & (1u << t))
+                column_times[t].push_back(row.rowTime);
+    dirty_times.clear();
+    built_intervals = 0;
+}
+
+void CalcSession::InsertRow(const NoteInfo& row) {
+    if (row.notes == 0)
+        return;
+    chart.InsertRow(row);
+    dirty_times.push_back(row.rowTime);
+
+    for (int t = 0; t < 4; t++) {
+        if (!(row.notes & (1u << t)))
+            continue;
+        vector<float>& times = column_times[t];
+        auto k = static_cast<size_t>(std::upper_bound(times.begin(), times.end(), row.rowTime) - times.begin());
+        times.insert(times.begin() + k, row.rowTime);
+        if (k + 1 < times.size())
+            dirty_times.push_back(times[k + 1]);
+        if (built_intervals > 0) {
+            calc.jacks[t].insert(calc.jacks[t].begin() + k, 0.f);
+            UpdateJacks(t, k, k + 4);
+            checkpoints.valid_notes[t] = std::min(checkpoints.valid_notes[t], k);
+        }
+    }
+}
+
+bool CalcSession::RemoveRow(float time) {
+    auto position = std::lower_bound(chart.row_times.begin(), chart.row_times.end(), time);
+    if (position == chart.row_times.end() || *position != time)
+        return false;
+    auto index = static_cast<size_t>(position - chart.row_times.begin());
+    unsigned int notes = chart.row_notes[index];
+    chart.RemoveRow(index);
+    dirty_times.push_back(time);
+
+    for (int t = 0; t < 4; t++) {
+        if (!(notes & (1u << t)))
+            continue;
+        vector<float>& times = column_times[t];
+        auto k = static_cast<size_t>(std::lower_bound(times.begin(), times.end(), time) - times.begin());
+        times.erase(times.begin() + k);
+        if (k < times.size())
+            dirty_times.push_back(times[k]);
+        if (built_intervals > 0) {
+            calc.jacks[t].erase(calc.jacks[t].begin() + k);
+            UpdateJacks(t, k, k + 3);
+            checkpoints.valid_notes[t] = std::min(checkpoints.valid_notes[t], k);
+        }
+    }
+    return true;
+}
+
+vector<NoteInfo> CalcSession::Rows() const {
+    vector<NoteInfo> rows(chart.row_notes.size());
+    for (size_t i = 0; i < rows.size(); i++)
+        rows[i] = NoteInfo {chart.row_notes[i], chart.row_times[i]};
+    return rows;
+}
+
+void CalcSession::UpdateJacks(int column, size_t first, size_t last) {
+    const vector<float>& times = column_times[column];
+    last = std::min(last, times.size());
+    // The ms between note k and the one before it, like ProcessRows
+    auto interval = [&](size_t k) {
+        float previous = k > 0 ? ScaledTime(times[k - 1]) : -5.f;
+        return 1000 * (ScaledTime(times[k]) - previous);
+    };
+    for (size_t k = first; k < last; k++) {
+        float interval1 = k >= 2 ? interval(k - 2) : 0.f;
+        float interval2 = k >= 1 ? interval(k - 1) : 0.f;
+        calc.jacks[column][k] = Calc::JackDifficulty(interval1, interval2, interval(k));
+    }
+}
+
+void CalcSession::UpdateSortedPoints(bool all) {
+    for (int h = 0; h < 2; h++) {
+        Hand& hand = h == 0 ? calc.left_hand : calc.right_hand;
+        SortedValues& values = sorted_values[h];
+        size_t n = hand.v_itvpoints.size();
+        if (all) {
+            hand.InitSortedPoints();
+            values.points = hand.v_itvpoints;
+            for (int t = 0; t < NUM_HAND_CHISELTYPES; t++) {
+                const float* diff = hand.ChiselDiff(static_cast<ChiselType>(t));
+                values.diffs[t].assign(diff, diff + n);
+            }
+            continue;
+        }
+
+        // The smoothed intervals that were there before, and the ones cut
+        // off, out; the smoothed ones, which hold any new ones, in
+        size_t old_n = values.points.size();
+        replaced.points.clear();
+        replacing.points.clear();
+        for (int t = 0; t < NUM_HAND_CHISELTYPES; t++) {
+            replaced.diffs[t].clear();
+            replacing.diffs[t].clear();
+        }
+        for (int interval : smoothed) {
+            auto i = static_cast<size_t>(interval);
+            if (i < old_n) {
+                replaced.points.push_back(values.points[i]);
+                for (int t = 0; t < NUM_HAND_CHISELTYPES; t++)
+                    replaced.diffs[t].push_back(values.diffs[t][i]);
+            }
+            replacing.points.push_back(hand.v_itvpoints[i]);
+            for (int t = 0; t < NUM_HAND_CHISELTYPES; t++)
+                replacing.diffs[t].push_back(hand.ChiselDiff(static_cast<ChiselType>(t))[i]);
+        }
+        for (size_t i = n; i < old_n; i++) {
+            replaced.points.push_back(values.points[i]);
+            for (int t = 0; t < NUM_HAND_CHISELTYPES; t++)
+                replaced.diffs[t].push_back(values.diffs[t][i]);
+        }
+        for (int t = 0; t < NUM_HAND_CHISELTYPES; t++)
+            hand.sorted_diffs[t].Replace(replaced.diffs[t].data(), replaced.points.data(), replaced.points.size(),
+                                         replacing.diffs[t].data(), replacing.points.data(),
+                                         replacing.points.size());
+
+        values.points.resize(n);
+        for (int t = 0; t < NUM_HAND_CHISELTYPES; t++)
+            values.diffs[t].resize(n);
+        for (size_t j = 0; j < smoothed.size(); j++) {
+            auto i = static_cast<size_t>(smoothed[j]);
+            values.points[i] = replacing.points[j];
+            for (int t = 0; t < NUM_HAND_CHISELTYPES; t++)
+                values.diffs[t][i] = replacing.diffs[t][j];
+        }
+    }
+}
+
+void CalcSession::FingerValues(int column, int interval, vector<float>& values) const {
+    const vector<float>& times = column_times[column];
+    auto first = std::partition_point(times.begin(), times.end(), [&](float time) {
+        return calc.IntervalOf(ScaledTime(time)) < interval;
+    });
+    values.clear();
+    float last = first != times.begin() ? ScaledTime(*(first - 1)) : -5.f;
+    for (auto it = first; it != times.end(); ++it) {
+        float scaledtime = ScaledTime(*it);
+        if (calc.IntervalOf(scaledtime) != interval)
+            break;
+        values.push_back(Calc::FingerValue(1000 * (scaledtime - last)));
+        last = scaledtime;
+    }
+}
+
+void CalcSession::Resize(int intervals) {
+    auto n = static_cast<size_t>(intervals);
+    calc.numitv = intervals;
+    calc.itv_counts.resize(n);
+    for (RawHand& hand : raw)
+        for (vector<float>* values : {&hand.nps, &hand.ms, &hand.ohjump, &hand.anchor, &hand.roll})
+            values->resize(n);
+    raw_hs.resize(n);
+    raw_jump.resize(n);
+    for (Hand* hand : {&calc.left_hand, &calc.right_hand}) {
+        for (vector<float>* values : {&hand->ohjumpscale, &hand->rollscale, &hand->hsscale, &hand->jumpscale,
+                                      &hand->anchorscale, &hand->v_itvNPSdiff, &hand->v_itvMSdiff})
+            values->resize(n);
+        hand->v_itvpoints.resize(n);
+        hand->v_chiseldiff.resize(NUM_HAND_CHISELTYPES * n);
+    }
+}
+
+void CalcSession::UpdateInterval(int interval) {
+    Calc::IntervalCounts counts;
+    auto first = std::partition_point(chart.row_times.begin(), chart.row_times.end(), [&](float time) {
+        return calc.IntervalOf(ScaledTime(time)) < interval;
+    });
+    for (auto row = static_cast<size_t>(first - chart.row_times.begin()); row < chart.row_times.size(); row++) {
+        if (calc.IntervalOf(ScaledTime(chart.row_times[row])) != interval)
+            break;
+        counts.AddRow(chart.row_notes[row], chart.row_taps[row]);
+    }
+    calc.itv_counts[interval] = counts;
+
+    for (int h = 0; h < 2; h++) {
+        Hand& hand = h == 0 ? calc.left_hand : calc.right_hand;
+        RawHand& values = raw[h];
+        FingerValues(2 * h, interval, finger_values[0]);
+        FingerValues(2 * h + 1, interval, finger_values[1]);
+        IntervalRange<float> f1 {finger_values[0].data(), finger_values[0].data() + finger_values[0].size()};
+        IntervalRange<float> f2 {finger_values[1].data(), finger_values[1].data() + finger_values[1].size()};
+
+        // In InitHand's order, the roll scaler sees the sorted fingers
+        hand.IntervalDiff(f1, f2, values.nps[interval], values.ms[interval]);
+        hand.v_itvpoints[interval] = static_cast<int>(f1.size() + f2.size());
+        values.ohjump[interval] = Calc::OHJumpScale(counts, h);
+        values.anchor[interval] = Calc::AnchorScale(counts, 2 * h, 2 * h + 1);
+        values.roll[interval] = Calc::RollScale(IntervalRange<const float> {f1.first, f1.last},
+                                                IntervalRange<const float> {f2.first, f2.last}, hand_intervals);
+    }
+    raw_hs[interval] = Calc::HSScale(counts);
+    raw_jump[interval] = Calc::JumpScale(counts);
+}
+
+void CalcSession::SmoothInterval(int interval) {
+    auto i = static_cast<size_t>(interval);
+    bool smooth_patterns = calc.SmoothPatterns;
+    auto pattern = [&](const vector<float>& values) {
+        return smooth_patterns ? smoothed_at(values, i, 1.f) : values[i];
+    };
+    for (int h = 0; h < 2; h++) {
+        Hand& hand = h == 0 ? calc.left_hand : calc.right_hand;
+        const RawHand& values = raw[h];
+        hand.v_itvNPSdiff[i] = smoothed_at(values.nps, i, 0.f);
+        hand.v_itvMSdiff[i] = hand.SmoothDifficulty ? ms_smoothed_at(values.ms, i) : values.ms[i];
+        hand.ohjumpscale[i] = pattern(values.ohjump);
+        hand.anchorscale[i] = pattern(values.anchor);
+        hand.rollscale[i] = pattern(values.roll);
+        hand.hsscale[i] = pattern(raw_hs);
+        hand.jumpscale[i] = pattern(raw_jump);
+    }
+}
+
+DifficultyRating CalcSession::Rate() {
+    if (chart.empty()) {
+        dirty_times.clear();
+        built_intervals = 0;
+        return DifficultyRating {0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f};
+    }
+
+    // As in Calc::Init
+    int intervals = static_cast<int>(std::ceil(chart.last_row_time / (music_rate * calc.IntervalSpan)));
+    intervals = std::max(intervals, 1);
+
+    dirty.clear();
+    bool resized = intervals != built_intervals;
+    bool all = built_intervals == 0;
+    if (all) {
+        Resize(intervals);
+        for (int t = 0; t < 4; t++) {
+            calc.jacks[t].resize(column_times[t].size());
+            UpdateJacks(t, 0, column_times[t].size());
+            checkpoints.valid_notes[t] = 0;
+        }
+        for (int i = 0; i < intervals; i++)
+            dirty.push_back(i);
+    } else if (resized) {
+        // Only the rows past the last interval change intervals, because
+        // they're all put into the last one
+        int first = std::min(intervals, built_intervals) - 1;
+        Resize(intervals);
+        for (int i = first; i < intervals; i++)
+            dirty.push_back(i);
+    }
+    for (float time : dirty_times)
+        dirty.push_back(calc.IntervalOf(ScaledTime(time)));
+    dirty_times.clear();
+    std::sort(dirty.begin(), dirty.end());
+    dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+
+    for (int interval : dirty)
+        UpdateInterval(interval);
+    updated_intervals = dirty.size();
+
+    // Smoothing carries a change two intervals on
+    smoothed.clear();
+    for (int interval : dirty)
+        for (int i = interval; i < std::min(interval + 3, intervals); i++)
+            smoothed.push_back(i);
+    std::sort(smoothed.begin(), smoothed.end());
+    smoothed.erase(std::unique(smoothed.begin(), smoothed.end()), smoothed.end());
+    for (int interval : smoothed) {
+        SmoothInterval(interval);
+        if (!resized) {
+            auto i = static_cast<size_t>(interval);
+            calc.left_hand.UpdateChiselDiffs(i, i + 1);
+            calc.right_hand.UpdateChiselDiffs(i, i + 1);
+        }
+    }
+    // The blocks of v_chiseldiff moved
+    if (resized) {
+        calc.left_hand.UpdateChiselDiffs(0, intervals);
+        calc.right_hand.UpdateChiselDiffs(0, intervals);
+    }
+    if (calc.left_hand.sorted_points)
+        UpdateSortedPoints(all);
+    if (all)
+        calc.InterleaveJacks();
+    else
+        calc.InterleaveJacks(checkpoints.valid_notes);
+    checkpoints.valid_intervals = all ? 0 : smoothed.empty() ? SIZE_MAX : static_cast<size_t>(smoothed.front());
+
+    calc.left_hand.fingerbias = calc.CalculateFingerbias(0, 1);
+    calc.right_hand.fingerbias = calc.CalculateFingerbias(2, 3);
+    calc.InitTotals();
+    built_intervals = intervals;
+
+#ifdef MINACALC_STATS
+    calc.stats = CalcStats();
+    calc.stats.calculations = 1;
+#endif
+    DifficultyRating rating = calc.CalcRatings(chart, score_goal);
+    // The scores this Rate() didn't make are now out of date
+    for (auto& scores : checkpoints.scores)
+        for (auto it = scores.begin(); it != scores.end();)
+            it = it->second.generation == checkpoints.generation ? std::next(it) : scores.erase(it);
+    checkpoints.generation++;
+    checkpoints.valid_intervals = SIZE_MAX;
+    checkpoints.valid_notes.fill(SIZE_MAX);
+    if (calc.options.search_stats)
+        calc.options.search_stats->Add(calc.evaluations);
+#ifdef MINACALC_STATS
+    if (calc.options.calc_stats)
+        calc.options.calc_stats->Add(calc.stats);
+#endif
+    return rating;
+}
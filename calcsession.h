@@ -0,0 +1,115 @@
+#ifndef MINACALC_CALCSESSION_H
+#define MINACALC_CALCSESSION_H
+
+#include "minacalc.h"
+#include <array>
+#include <vector>
+
+/* Rates a chart while it's being edited, e.g. to show the ratings live in
+an editor. Rows go in and out one at a time and Rate() only redoes the
+parts of Calc::Init the edits since the last Rate() touched:
+ - the counts, fingers, NPS/MS difficulties and pattern scalers of the 0.5s
+   intervals holding an edited row, or holding the next note in one of the
+   row's columns (its ms value changes);
+ - the smoothing windows over those, i.e. them and the two intervals after,
+   and those intervals' chisel difficulties, which it swaps into the sorted
+   ones with SortedPoints::Replace if sorted_points is set;
+ - the jack difficulties of the edited row and the next three notes in its
+   columns, right away, and their lanes from the first edited note of each
+   column on.
+The totals (MaxPoints, fingerbias) are summed up again in order. The
+chisels still search as usual, but every score they ask for is carried on
+from what the last Rate() left (see ScoreCheckpoints): a skill it scored
+starts from the last checkpoint before the first interval, or note of a
+column, that changed, one it didn't from the start. So scoring costs about
+the part of the chart from the first edit on, and an edit near the end is
+cheap while one near the start costs a full rating. The sums go in the
+same order, so the ratings are exactly
+MinaSDCalc(Chart(), music_rate, score_goal, options). With fast_points,
+and sorted_points without stamina, the scores aren't sums in order and are
+made from scratch.
+
+The chart is its rows with notes, in chronological order; its length is
+the time of the last one. The first Rate(), and the first after the chart
+was emptied or Reset(), does all intervals. */
+class CalcSession
+{
+public:
+    CalcSession(float music_rate, float score_goal, const CalcOptions& options = CalcOptions());
+
+    CalcSession(const CalcSession&) = delete;
+    CalcSession& operator=(const CalcSession&) = delete;
+
+    // Starts over with these rows, leaving out the ones without notes
+    void Reset(const std::vector<NoteInfo>& rows);
+    // Adds a row after the ones at the same time. Rows without notes are
+    // ignored.
+    void InsertRow(const NoteInfo& row);
+    // Removes the first row at exactly `time`. Returns false if there's
+    // none.
+    bool RemoveRow(float time);
+
+    const PreparedChart& Chart() const { return chart; }
+    std::vector<NoteInfo> Rows() const;
+
+    // Ratings of the chart as it is now
+    DifficultyRating Rate();
+
+    // Intervals the last Rate() recomputed before smoothing
+    size_t UpdatedIntervals() const { return updated_intervals; }
+
+private:
+    // Values of one hand's intervals before smoothing
+    struct RawHand {
+        std::vector<float> nps, ms, ohjump, anchor, roll;
+    };
+
+    void Resize(int intervals);
+    void UpdateInterval(int interval);
+    void SmoothInterval(int interval);
+    // Redoes the jack difficulties of the column's notes first .. last - 1
+    void UpdateJacks(int column, size_t first, size_t last);
+    // Brings the hands' sorted_diffs up to date with the smoothed
+    // intervals, or all of them
+    void UpdateSortedPoints(bool all);
+    // Ms values of the column's notes in `interval`, as ProcessRows
+    // appends them
+    void FingerValues(int column, int interval, std::vector<float>& values) const;
+    float ScaledTime(float row_time) const { return row_time / music_rate; }
+
+    float music_rate;
+    float score_goal;
+    PreparedChart chart;
+    Calc calc;
+
+    // Row times at 1.0x of the notes in each column
+    std::array<std::vector<float>, 4> column_times;
+    // Times at 1.0x of edited rows and of notes that got a new previous
+    // note; their intervals are redone by the next Rate()
+    std::vector<float> dirty_times;
+    // Number of intervals the data in here is for; 0 before the first
+    // Rate()
+    int built_intervals = 0;
+    size_t updated_intervals = 0;
+
+    ScoreCheckpoints checkpoints;
+
+    std::array<RawHand, 2> raw;
+    std::vector<float> raw_hs, raw_jump; // The same for both hands
+
+    // The chisel difficulties and points a hand's sorted_diffs hold
+    struct SortedValues {
+        std::array<std::vector<float>, NUM_HAND_CHISELTYPES> diffs;
+        std::vector<int> points;
+    };
+    std::array<SortedValues, 2> sorted_values;
+
+    // Reused by every Rate()
+    std::vector<int> dirty;
+    SortedValues replaced, replacing;
+    std::vector<int> smoothed;
+    std::vector<float> finger_values[2];
+    std::vector<float> hand_intervals;
+};
+
+#endif //MINACALC_CALCSESSION_H
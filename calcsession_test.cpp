@@ -0,0 +1,169 @@
+#include "calcsession.h"
+#include "chartgen.h"
+#include "minacalc.h"
+#include "smloader.h"
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+/* minacalc_calcsession_test
+
+Puts random edits through a CalcSession and checks every Rate() against a
+full MinaSDCalc of the chart as it is then, bit for bit. The edits are
+rows put in or taken out anywhere, in bursts between two Rate()s, with
+some past the end and some taking the last rows out so the number of
+intervals changes both ways, and now and then the chart emptied or Reset.
+Runs with the options that change how the scores are summed. Run by
+ctest. */
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const string& what) {
+    if (ok)
+        return;
+    failures++;
+    std::cerr << "FAIL: " << what << '\n';
+}
+
+const char* const field_names[8] = {"overall", "stream", "jumpstream", "handstream",
+                                    "stamina", "jack", "chordjack", "technical"};
+
+// Returns false if any field differs
+bool check_rating(const DifficultyRating& got, const DifficultyRating& expected, const string& what) {
+    bool all = true;
+    for (int f = 0; f < 8; f++) {
+        float a = (&got.overall)[f];
+        float b = (&expected.overall)[f];
+        bool ok = std::memcmp(&a, &b, sizeof a) == 0;
+        check(ok, what + ": " + field_names[f] + " " + std::to_string(a) + " instead of " + std::to_string(b));
+        all = all && ok;
+    }
+    return all;
+}
+
+// splitmix64
+class Random
+{
+public:
+    explicit Random(uint64_t seed) : state(seed) {}
+
+    uint64_t Next() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    // In [0, n)
+    unsigned int Below(unsigned int n) { return static_cast<unsigned int>(Next() % n); }
+
+private:
+    uint64_t state;
+};
+
+// Runs the jobs on threads of their own, like a pool would
+void thread_executor(size_t count, const std::function<void(size_t)>& job) {
+    vector<std::thread> threads;
+    for (size_t i = 0; i < count; i++)
+        threads.emplace_back(job, i);
+    for (std::thread& thread : threads)
+        thread.join();
+}
+
+vector<NoteInfo> generated(ChartPattern pattern, float seconds, uint64_t seed) {
+    ChartGenOptions options;
+    options.pattern = pattern;
+    options.seconds = seconds;
+    options.seed = seed;
+    return load_from_buffer(generate_sm(options))[0].notes;
+}
+
+// One edit: a row in or out, on a 16th grid at 150 BPM so rows land on
+// each other's times too
+void edit(CalcSession& session, Random& random) {
+    vector<NoteInfo> rows = session.Rows();
+    float end = rows.empty() ? 0.f : rows.back().rowTime;
+    switch (random.Below(8)) {
+    case 0: // Past the end
+        session.InsertRow(NoteInfo {1 + random.Below(15), end + 0.1f * static_cast<float>(1 + random.Below(30))});
+        break;
+    case 1: // The last row
+        if (!rows.empty())
+            session.RemoveRow(end);
+        break;
+    case 2:
+    case 3:
+    case 4: // Anywhere
+        if (!rows.empty())
+            session.RemoveRow(rows[random.Below(static_cast<unsigned int>(rows.size()))].rowTime);
+        break;
+    default: {
+        auto sixteenths = static_cast<unsigned int>(end / 0.1f) + 2;
+        session.InsertRow(NoteInfo {1 + random.Below(15), 0.1f * static_cast<float>(random.Below(sixteenths))});
+        break;
+    }
+    }
+}
+
+void test_session(const string& name, const CalcOptions& options, float rate, float goal, uint64_t seed) {
+    Random random(seed);
+    CalcSession session(rate, goal, options);
+    session.Reset(generated(static_cast<ChartPattern>(seed % NUM_CHART_PATTERNS), 60.f, seed));
+    for (int round = 0; round < 60; round++) {
+        switch (random.Below(30)) {
+        case 0:
+            session.Reset({});
+            break;
+        case 1:
+            session.Reset(generated(static_cast<ChartPattern>(random.Below(NUM_CHART_PATTERNS)),
+                                    static_cast<float>(10 + random.Below(60)), random.Next()));
+            break;
+        default:
+            for (unsigned int e = 1 + random.Below(4); e > 0; e--)
+                edit(session, random);
+            break;
+        }
+        DifficultyRating got = session.Rate();
+        DifficultyRating expected = MinaSDCalc(session.Chart(), rate, goal, options);
+        if (!check_rating(got, expected, name + ", seed " + std::to_string(seed) + ", round " + std::to_string(round)))
+            return;
+    }
+}
+
+} // namespace
+
+int main() {
+    CalcOptions sorted;
+    sorted.sorted_points = true;
+    CalcOptions probes;
+    probes.probes = 3;
+    CalcOptions fast;
+    fast.fast_points = true;
+    CalcOptions threads;
+    threads.executor = thread_executor;
+    struct {
+        const char* name;
+        CalcOptions options;
+    } const cases[] = {{"default", CalcOptions()}, {"sorted_points", sorted}, {"probes 3", probes},
+                       {"fast_points", fast}, {"executor", threads}};
+
+    for (const auto& c : cases)
+        for (uint64_t seed = 1; seed <= 3; seed++)
+            test_session(c.name, c.options, seed == 2 ? 1.3f : 1.f, seed == 3 ? 0.8f : 0.93f, seed);
+
+    if (failures > 0) {
+        std::cerr << failures << " checks failed\n";
+        return 1;
+    }
+    std::cerr << "all checks passed\n";
+    return 0;
+}
@@ -0,0 +1,352 @@
+#include "chartcache.h"
+#include "contenthash.h"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+using std::string;
+using std::vector;
+
+namespace {
+
+const char cache_magic[8] = {'M', 'I', 'N', 'A', 'C', 'A', 'C', 'H'};
+
+void put_u32(string& out, uint32_t value) {
+    for (int i = 0; i < 4; i++)
+        out.push_back(static_cast<char>(value >> (8 * i)));
+}
+
+void put_u64(string& out, uint64_t value) {
+    for (int i = 0; i < 8; i++)
+        out.push_back(static_cast<char>(value >> (8 * i)));
+}
+
+void put_varint(string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+void put_bytes(string& out, std::string_view bytes) {
+    put_varint(out, bytes.size());
+    out += bytes;
+}
+
+void put_chart(string& out, std::string_view name, uint64_t content_hash, uint64_t rows, uint8_t flags,
+               std::string_view times, std::string_view masks) {
+    put_bytes(out, name);
+    put_u64(out, content_hash);
+    put_varint(out, rows);
+    out.push_back(static_cast<char>(flags));
+    put_bytes(out, times);
+    put_bytes(out, masks);
+}
+
+// Bounds checked reads over the mapped cache. Every read fails once one
+// has failed, so a record can be read in one go and checked at the end.
+class Cursor
+{
+public:
+    Cursor(const unsigned char* data, size_t size) : pos(data), end(data + size) {}
+
+    bool ok() const { return good; }
+
+    uint32_t u32() {
+        uint32_t value = 0;
+        if (Need(4))
+            for (int i = 0; i < 4; i++)
+                value |= static_cast<uint32_t>(*pos++) << (8 * i);
+        return value;
+    }
+
+    uint64_t u64() {
+        uint64_t value = 0;
+        if (Need(8))
+            for (int i = 0; i < 8; i++)
+                value |= static_cast<uint64_t>(*pos++) << (8 * i);
+        return value;
+    }
+
+    uint8_t u8() {
+        return Need(1) ? *pos++ : 0;
+    }
+
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (!Need(1))
+                return 0;
+            unsigned char byte = *pos++;
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return value;
+        }
+        good = false;
+        return 0;
+    }
+
+    // A varint length followed by that many bytes
+    const unsigned char* bytes(size_t& size) {
+        size = static_cast<size_t>(varint());
+        if (!Need(size))
+            return nullptr;
+        const unsigned char* start = pos;
+        pos += size;
+        return start;
+    }
+
+private:
+    bool Need(size_t size) {
+        good = good && static_cast<size_t>(end - pos) >= size;
+        return good;
+    }
+
+    const unsigned char* pos;
+    const unsigned char* end;
+    bool good = true;
+};
+
+// Varint decoding for the row streams, which are only bounds checked
+bool read_varint(const unsigned char*& pos, const unsigned char* end, uint32_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 35 && pos < end; shift += 7) {
+        unsigned char byte = *pos++;
+        value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+uint32_t float_bits(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof bits);
+    return bits;
+}
+
+float bits_float(uint32_t bits) {
+    float value;
+    std::memcpy(&value, &bits, sizeof value);
+    return value;
+}
+
+std::string_view as_view(const unsigned char* bytes, size_t size) {
+    return std::string_view(reinterpret_cast<const char*>(bytes), size);
+}
+
+} // namespace
+
+bool file_stamp(const string& path, FileStamp& stamp) {
+    std::error_code error;
+    uint64_t size = std::filesystem::file_size(path, error);
+    if (error)
+        return false;
+    auto mtime = std::filesystem::last_write_time(path, error);
+    if (error)
+        return false;
+    stamp.size = size;
+    stamp.mtime = static_cast<int64_t>(mtime.time_since_epoch().count());
+    return true;
+}
+
+CachedRowReader::CachedRowReader(const unsigned char* times, const unsigned char* times_end,
+                                 const unsigned char* masks, const unsigned char* masks_end,
+                                 uint32_t rows, bool wide_masks)
+    : times(times), times_end(times_end), masks(masks), masks_end(masks_end),
+      rows_left(rows), wide_masks(wide_masks) {}
+
+bool CachedRowReader::Next(NoteInfo& row) {
+    if (rows_left == 0)
+        return false;
+
+    uint32_t zigzag;
+    if (!read_varint(times, times_end, zigzag)) {
+        rows_left = 0;
+        return false;
+    }
+    time_bits += (zigzag >> 1) ^ (0u - (zigzag & 1));
+    row.rowTime = bits_float(time_bits);
+
+    if (wide_masks) {
+        if (!read_varint(masks, masks_end, row.notes)) {
+            rows_left = 0;
+            return false;
+        }
+    } else {
+        const unsigned char* byte = masks + row_index / 2;
+        if (byte >= masks_end) {
+            rows_left = 0;
+            return false;
+        }
+        row.notes = (row_index % 2 == 0) ? (*byte & 0xfu) : (*byte >> 4);
+    }
+
+    row_index++;
+    rows_left--;
+    return true;
+}
+
+CachedRowReader CachedChart::Reader() const {
+    return CachedRowReader(times, times + times_size, masks, masks + masks_size,
+                           row_count, (flags & CHART_WIDE_MASKS) != 0);
+}
+
+PreparedChart CachedChart::Prepare() const {
+    PreparedChart chart;
+    Prepare(chart);
+    return chart;
+}
+
+void CachedChart::Prepare(PreparedChart& chart) const {
+    chart.Clear();
+    CachedRowReader reader = Reader();
+    NoteInfo row;
+    while (reader.Next(row))
+        chart.AddRow(row);
+    chart.Finish();
+}
+
+vector<NoteInfo> CachedChart::Rows() const {
+    vector<NoteInfo> rows;
+    rows.reserve(row_count);
+    CachedRowReader reader = Reader();
+    NoteInfo row;
+    while (reader.Next(row))
+        rows.push_back(row);
+    return rows;
+}
+
+bool ChartCache::Open(const string& path) {
+    Close();
+    if (!mapping.Open(path))
+        return false;
+
+    Cursor cursor(mapping.data(), mapping.size());
+    size_t magic_size = sizeof cache_magic;
+    if (mapping.size() < magic_size || std::memcmp(mapping.data(), cache_magic, magic_size) != 0) {
+        Close();
+        return false;
+    }
+    for (size_t i = 0; i < magic_size; i++)
+        cursor.u8();
+    uint32_t version = cursor.u32();
+    uint32_t file_count = cursor.u32();
+    if (!cursor.ok() || version != CHART_CACHE_VERSION) {
+        Close();
+        return false;
+    }
+
+    for (uint32_t f = 0; f < file_count && cursor.ok(); f++) {
+        CachedFile file;
+        size_t size;
+        const unsigned char* bytes = cursor.bytes(size);
+        file.path = as_view(bytes, size);
+        file.content_hash = cursor.u64();
+        file.stamp.size = cursor.u64();
+        file.stamp.mtime = static_cast<int64_t>(cursor.u64());
+        uint64_t chart_count = cursor.varint();
+
+        for (uint64_t c = 0; c < chart_count && cursor.ok(); c++) {
+            CachedChart chart;
+            bytes = cursor.bytes(size);
+            chart.name = as_view(bytes, size);
+            chart.content_hash = cursor.u64();
+            chart.row_count = static_cast<uint32_t>(cursor.varint());
+            chart.flags = cursor.u8();
+            chart.times = cursor.bytes(chart.times_size);
+            chart.masks = cursor.bytes(chart.masks_size);
+            bool masks_fit = (chart.flags & CHART_WIDE_MASKS) || chart.masks_size == (chart.row_count + 1ull) / 2;
+            if (!masks_fit)
+                break;
+            file.charts.push_back(chart);
+        }
+        if (!cursor.ok() || file.charts.size() != chart_count)
+            break;
+        files.push_back(std::move(file));
+    }
+
+    if (!cursor.ok() || files.size() != file_count) {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void ChartCache::Close() {
+    files.clear();
+    mapping.Close();
+}
+
+void ChartCacheWriter::AddFile(const string& path, const FileStamp& stamp, uint64_t content_hash,
+                               const SMNotes& charts) {
+    put_bytes(body, path);
+    put_u64(body, content_hash);
+    put_u64(body, stamp.size);
+    put_u64(body, static_cast<uint64_t>(stamp.mtime));
+    put_varint(body, charts.size());
+
+    string times;
+    string masks;
+    for (const ChartInfo& chart : charts) {
+        bool wide_masks = false;
+        for (const NoteInfo& row : chart.notes)
+            wide_masks = wide_masks || row.notes > 0xfu;
+
+        times.clear();
+        masks.clear();
+        uint32_t previous_bits = 0;
+        for (size_t i = 0; i < chart.notes.size(); i++) {
+            const NoteInfo& row = chart.notes[i];
+            uint32_t bits = float_bits(row.rowTime);
+            auto delta = static_cast<int32_t>(bits - previous_bits);
+            previous_bits = bits;
+            put_varint(times, (static_cast<uint32_t>(delta) << 1) ^ static_cast<uint32_t>(delta >> 31));
+
+            if (wide_masks)
+                put_varint(masks, row.notes);
+            else if (i % 2 == 0)
+                masks.push_back(static_cast<char>(row.notes));
+            else
+                masks.back() = static_cast<char>(static_cast<unsigned char>(masks.back()) | (row.notes << 4));
+        }
+
+        uint64_t chart_hash = ::content_hash(chart.notes.data(), chart.notes.size() * sizeof(NoteInfo));
+        put_chart(body, chart.difficultyName, chart_hash, chart.notes.size(),
+                  wide_masks ? CHART_WIDE_MASKS : 0, times, masks);
+    }
+    file_count++;
+}
+
+void ChartCacheWriter::AddFile(const CachedFile& file, const FileStamp& stamp) {
+    put_bytes(body, file.path);
+    put_u64(body, file.content_hash);
+    put_u64(body, stamp.size);
+    put_u64(body, static_cast<uint64_t>(stamp.mtime));
+    put_varint(body, file.charts.size());
+    for (const CachedChart& chart : file.charts)
+        put_chart(body, chart.name, chart.content_hash, chart.row_count, chart.flags,
+                  as_view(chart.times, chart.times_size), as_view(chart.masks, chart.masks_size));
+    file_count++;
+}
+
+bool ChartCacheWriter::Save(const string& path) const {
+    string header(cache_magic, sizeof cache_magic);
+    put_u32(header, CHART_CACHE_VERSION);
+    put_u32(header, file_count);
+
+    string temp_path = path + ".tmp";
+    {
+        std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+        if (!out)
+            return false;
+        out.write(header.data(), static_cast<std::streamsize>(header.size()));
+        out.write(body.data(), static_cast<std::streamsize>(body.size()));
+        if (!out)
+            return false;
+    }
+    std::error_code error;
+    std::filesystem::rename(temp_path, path, error);
+    return !error;
+}
@@ -0,0 +1,154 @@
+#ifndef MINACALC_CHARTCACHE_H
+#define MINACALC_CHARTCACHE_H
+
+#include "mappedfile.h"
+#include "minacalc.h"
+#include "smloader.h"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/* Binary cache of parsed .sm files, so a pack only has to be parsed once.
+It doubles as the pack's index: every file's size and modification time are
+kept, so updating the cache only has to stat the files and parse the ones that
+changed (see batchConvert).
+
+Layout (integers are little endian, varints are LEB128):
+    "MINACACH"                      magic
+    u32 version                     CHART_CACHE_VERSION
+    u32 number of files
+    per file:
+        varint length, bytes        path of the .sm
+        u64                         content_hash of the .sm's bytes
+        u64                         size of the .sm
+        u64                         modification time of the .sm, see FileStamp
+        varint number of charts
+        per chart:
+            varint length, bytes    difficulty name, as the loader returns it
+            u64                     content_hash of the chart's NoteInfo
+            varint number of rows
+            u8 flags                CHART_WIDE_MASKS or 0
+            varint length, bytes    row times
+            varint length, bytes    row masks
+
+Row times are stored as the bit patterns of NoteInfo::rowTime, each as the
+zigzag varint of its difference to the previous row's pattern (the first
+row's to 0). Rows are in time order, so that's usually 2-3 bytes a row, and
+decoding gives back the exact same floats. Masks take 4 bits a row, two rows
+per byte with the earlier row in the low nibble, unless a row uses more than
+the first 4 columns (6 key charts, comment lines); then the chart has
+CHART_WIDE_MASKS set and stores one varint per row.
+
+The chart hash is the same one MakeRatingKey uses, so ratings can be looked
+up in a RatingCache without decoding the rows.
+
+Bump CHART_CACHE_VERSION whenever the layout or the loader's output changes.
+Caches of any other version are rejected. */
+const uint32_t CHART_CACHE_VERSION = 2;
+const uint8_t CHART_WIDE_MASKS = 1;
+
+/* What a file looked like when it was cached. The modification time is the
+file_time_type's tick count, which is only comparable on the same platform;
+a stamp that doesn't match just means the file gets hashed again. */
+struct FileStamp {
+    uint64_t size = 0;
+    int64_t mtime = 0;
+
+    bool operator==(const FileStamp& other) const {
+        return size == other.size && mtime == other.mtime;
+    }
+};
+
+// Stats the file. Returns false, leaving `stamp` alone, if it can't.
+bool file_stamp(const std::string& path, FileStamp& stamp);
+
+// Decodes the rows of a CachedChart one at a time
+class CachedRowReader
+{
+public:
+    CachedRowReader(const unsigned char* times, const unsigned char* times_end,
+                    const unsigned char* masks, const unsigned char* masks_end,
+                    uint32_t rows, bool wide_masks);
+
+    // False once all rows are read, or if the data ends early
+    bool Next(NoteInfo& row);
+
+private:
+    const unsigned char* times;
+    const unsigned char* times_end;
+    const unsigned char* masks;
+    const unsigned char* masks_end;
+    uint32_t rows_left;
+    uint32_t row_index = 0;
+    uint32_t time_bits = 0;
+    bool wide_masks;
+};
+
+// A chart in an open ChartCache. Points into the cache's mapping, so it's
+// only valid as long as the cache is open.
+struct CachedChart {
+    std::string_view name;
+    uint64_t content_hash = 0; // Of the rows as NoteInfo
+    uint32_t row_count = 0;
+    uint8_t flags = 0;
+    const unsigned char* times = nullptr;
+    size_t times_size = 0;
+    const unsigned char* masks = nullptr;
+    size_t masks_size = 0;
+
+    CachedRowReader Reader() const;
+    // Decodes the rows straight into a PreparedChart, for MinaSDCalc
+    PreparedChart Prepare() const;
+    // Same, into `chart`, reusing its memory
+    void Prepare(PreparedChart& chart) const;
+    // For anything that wants the NoteInfo (soloCalc, the all rates MinaSDCalc)
+    std::vector<NoteInfo> Rows() const;
+};
+
+struct CachedFile {
+    std::string_view path;
+    uint64_t content_hash = 0;
+    FileStamp stamp;
+    std::vector<CachedChart> charts;
+};
+
+// A memory mapped chart cache
+class ChartCache
+{
+public:
+    /* Maps the cache and indexes its files and charts; the rows are only
+    decoded when asked for. Returns false, leaving the cache empty, if the
+    file can't be mapped, is of another version or is malformed. */
+    bool Open(const std::string& path);
+    void Close();
+
+    const std::vector<CachedFile>& Files() const { return files; }
+
+private:
+    MappedFile mapping;
+    std::vector<CachedFile> files;
+};
+
+// Builds a chart cache in memory, one .sm file at a time
+class ChartCacheWriter
+{
+public:
+    void AddFile(const std::string& path, const FileStamp& stamp, uint64_t content_hash,
+                 const SMNotes& charts);
+    // Copies a file out of another cache as it is, for files that didn't
+    // change. Only the stamp is replaced.
+    void AddFile(const CachedFile& file, const FileStamp& stamp);
+
+    /* Writes the cache next to `path` and renames it over `path`, so readers
+    never see half a cache. Returns false if it can't be written. */
+    bool Save(const std::string& path) const;
+
+    uint32_t FileCount() const { return file_count; }
+
+private:
+    std::string body; // Everything after the header
+    uint32_t file_count = 0;
+};
+
+#endif //MINACALC_CHARTCACHE_H
@@ -0,0 +1,183 @@
+#include "chartgen.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+using std::string;
+
+namespace {
+
+const char* const pattern_names[NUM_CHART_PATTERNS] = {
+    "stream", "jumpstream", "handstream", "chordjack", "minijacks", "rolls", "stamina"
+};
+
+const float pattern_bpms[NUM_CHART_PATTERNS] = {180.f, 175.f, 165.f, 180.f, 170.f, 200.f, 175.f};
+
+const int rows_per_measure = 16;
+
+// splitmix64. The standard distributions aren't specified exactly, so the
+// generator brings its own to give the same charts everywhere.
+class Random
+{
+public:
+    explicit Random(uint64_t seed) : state(seed) {}
+
+    uint64_t Next() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    // In [0, n)
+    unsigned int Below(unsigned int n) { return static_cast<unsigned int>(Next() % n); }
+
+private:
+    uint64_t state;
+};
+
+int popcount4(unsigned int mask) {
+    return (mask & 1) + (mask >> 1 & 1) + (mask >> 2 & 1) + (mask >> 3 & 1);
+}
+
+// A random chord of `size` columns
+unsigned int random_chord(Random& random, int size) {
+    unsigned int mask = 0;
+    while (popcount4(mask) < size)
+        mask |= 1u << random.Below(4);
+    return mask;
+}
+
+// One note in a column the previous row didn't use, if there is one
+unsigned int single_after(Random& random, unsigned int previous) {
+    if (previous == 0xf)
+        return 1u << random.Below(4);
+    for (;;) {
+        unsigned int note = 1u << random.Below(4);
+        if (!(note & previous))
+            return note;
+    }
+}
+
+// A chord of `size` that avoids the previous row's columns where it can
+unsigned int chord_after(Random& random, unsigned int previous, int size) {
+    int free_columns = 4 - popcount4(previous);
+    if (free_columns < size)
+        return random_chord(random, size);
+    for (;;) {
+        unsigned int chord = random_chord(random, size);
+        if (!(chord & previous))
+            return chord;
+    }
+}
+
+// Row masks on the 16th grid, including the empty rows
+class PatternWriter
+{
+public:
+    PatternWriter(ChartPattern pattern, uint64_t seed) : pattern(pattern), random(seed) {}
+
+    unsigned int Row(size_t row) {
+        unsigned int notes = RowOf(pattern, row);
+        if (notes != 0)
+            previous = notes;
+        return notes;
+    }
+
+private:
+    unsigned int RowOf(ChartPattern type, size_t row) {
+        bool on_beat = row % 4 == 0;
+        switch (type) {
+            case STREAM_PATTERN:
+                return single_after(random, previous);
+            case JUMPSTREAM_PATTERN:
+                return on_beat ? chord_after(random, previous, 2) : single_after(random, previous);
+            case HANDSTREAM_PATTERN:
+                if (on_beat)
+                    return random.Below(2) ? random_chord(random, 3) : chord_after(random, previous, 2);
+                return single_after(random, previous);
+            case CHORDJACK_PATTERN: {
+                if (row % 2 != 0)
+                    return 0;
+                // Keep one column of the last chord, so every chord jacks
+                unsigned int size = 2 + random.Below(3);
+                unsigned int kept = previous ? single_after(random, ~previous & 0xf) : 0;
+                unsigned int chord = kept;
+                while (popcount4(chord) < static_cast<int>(size))
+                    chord |= 1u << random.Below(4);
+                return chord;
+            }
+            case MINIJACK_PATTERN:
+                if (previous && random.Below(6) == 0)
+                    return previous;
+                return single_after(random, previous);
+            case ROLL_PATTERN: {
+                if (row % rows_per_measure == 0) {
+                    static const unsigned char orders[6][4] = {
+                        {0, 1, 2, 3}, {3, 2, 1, 0}, {0, 2, 1, 3}, {3, 1, 2, 0}, {1, 0, 3, 2}, {0, 3, 1, 2}
+                    };
+                    roll = orders[random.Below(6)];
+                }
+                return 1u << roll[row % 4];
+            }
+            case STAMINA_PATTERN: {
+                // 8 measure sections, with a measure of rest every 32
+                size_t measure = row / rows_per_measure;
+                if (measure % 32 == 31)
+                    return 0;
+                return RowOf(measure / 8 % 2 ? JUMPSTREAM_PATTERN : STREAM_PATTERN, row);
+            }
+            default:
+                return 0;
+        }
+    }
+
+    ChartPattern pattern;
+    Random random;
+    unsigned int previous = 0;
+    const unsigned char* roll = nullptr;
+};
+
+} // namespace
+
+const char* pattern_name(ChartPattern pattern) {
+    return pattern >= 0 && pattern < NUM_CHART_PATTERNS ? pattern_names[pattern] : "unknown";
+}
+
+bool parse_pattern(const string& name, ChartPattern& pattern) {
+    for (int i = 0; i < NUM_CHART_PATTERNS; i++)
+        if (name == pattern_names[i]) {
+            pattern = static_cast<ChartPattern>(i);
+            return true;
+        }
+    return false;
+}
+
+string generate_sm(const ChartGenOptions& options) {
+    float bpm = options.bpm > 0.f ? options.bpm : pattern_bpms[options.pattern];
+    float seconds_per_measure = 4.f * 60.f / bpm;
+    auto measures = static_cast<size_t>(std::ceil(std::max(options.seconds, 0.f) / seconds_per_measure));
+
+    char line[128];
+    string sm;
+    // 5 bytes a row and 2 a measure separator, plus the header
+    sm.reserve(measures * (rows_per_measure * 5 + 2) + 256);
+    std::snprintf(line, sizeof line, "#TITLE:Generated %s %llu;\n#BPMS:0.000=%.3f;\n#STOPS:;\n",
+                  pattern_name(options.pattern), static_cast<unsigned long long>(options.seed), bpm);
+    sm += line;
+    sm += "#NOTES:\n     dance-single:\n     minacalc_bench:\n     Challenge:\n     20:\n     0,0,0,0,0:\n";
+
+    PatternWriter writer(options.pattern, options.seed);
+    for (size_t m = 0; m < measures; m++) {
+        if (m > 0)
+            sm += ",\n";
+        for (int r = 0; r < rows_per_measure; r++) {
+            unsigned int notes = writer.Row(m * rows_per_measure + r);
+            for (int column = 0; column < 4; column++)
+                sm.push_back(notes & (1u << column) ? '1' : '0');
+            sm.push_back('\n');
+        }
+    }
+    sm += ";\n";
+    return sm;
+}
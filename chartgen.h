@@ -0,0 +1,36 @@
+#ifndef MINACALC_CHARTGEN_H
+#define MINACALC_CHARTGEN_H
+
+#include <cstdint>
+#include <string>
+
+// Kinds of synthetic charts the generator can write
+enum ChartPattern {
+    STREAM_PATTERN, // 16th singles, no jacks
+    JUMPSTREAM_PATTERN, // Stream with a jump on every beat
+    HANDSTREAM_PATTERN, // Stream with a hand or a jump on every beat
+    CHORDJACK_PATTERN, // 8th chords of 2-4 notes that keep at least one column
+    MINIJACK_PATTERN, // Stream where every few notes repeat the previous column
+    ROLL_PATTERN, // Each measure repeats one ordering of the four columns
+    STAMINA_PATTERN, // Alternating stream and jumpstream sections with short breaks
+    NUM_CHART_PATTERNS
+};
+
+const char* pattern_name(ChartPattern pattern);
+// Looks a pattern up by pattern_name. Returns false if there's none.
+bool parse_pattern(const std::string& name, ChartPattern& pattern);
+
+struct ChartGenOptions {
+    ChartPattern pattern = STREAM_PATTERN;
+    float seconds = 120.f; // Length of the chart at 1.0x
+    float bpm = 0.f; // 0 means the pattern's own tempo
+    uint64_t seed = 1;
+};
+
+/* Writes a .sm file holding one dance-single chart of the pattern, on a 16th
+grid at a constant BPM. The same options always give the same text, on every
+platform, so timings of different builds can be compared. Parse it with
+load_from_buffer to get the NoteInfo. */
+std::string generate_sm(const ChartGenOptions& options);
+
+#endif //MINACALC_CHARTGEN_H
@@ -0,0 +1,39 @@
+#include "contenthash.h"
+#include <cstring>
+
+uint64_t content_hash(const void* data, size_t size, uint64_t seed) {
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+
+    uint64_t h = seed ^ (static_cast<uint64_t>(size) * m);
+
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    const unsigned char* end = bytes + (size & ~static_cast<size_t>(7));
+    for (; bytes != end; bytes += 8) {
+        uint64_t k;
+        std::memcpy(&k, bytes, sizeof k);
+
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+
+        h ^= k;
+        h *= m;
+    }
+
+    switch (size & 7) {
+    case 7: h ^= static_cast<uint64_t>(bytes[6]) << 48; // fallthrough
+    case 6: h ^= static_cast<uint64_t>(bytes[5]) << 40; // fallthrough
+    case 5: h ^= static_cast<uint64_t>(bytes[4]) << 32; // fallthrough
+    case 4: h ^= static_cast<uint64_t>(bytes[3]) << 24; // fallthrough
+    case 3: h ^= static_cast<uint64_t>(bytes[2]) << 16; // fallthrough
+    case 2: h ^= static_cast<uint64_t>(bytes[1]) << 8; // fallthrough
+    case 1: h ^= static_cast<uint64_t>(bytes[0]);
+            h *= m;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
@@ -0,0 +1,13 @@
+#ifndef MINACALC_CONTENTHASH_H
+#define MINACALC_CONTENTHASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+/* 64 bit hash of a block of memory (MurmurHash64A), used to tell whether a
+file or a chart changed. Not cryptographic. Reads the data as native
+endian 8 byte words, so hashes are only comparable between machines of
+the same endianness. */
+uint64_t content_hash(const void* data, size_t size, uint64_t seed = 0);
+
+#endif //MINACALC_CONTENTHASH_H
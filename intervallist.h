@@ -0,0 +1,75 @@
+#ifndef MINACALC_INTERVALLIST_H
+#define MINACALC_INTERVALLIST_H
+
+#include <cstddef>
+#include <vector>
+
+// View of the values of one interval, usable in range-for
+template <typename T>
+struct IntervalRange
+{
+    T* first;
+    T* last;
+
+    T* begin() const { return first; }
+    T* end() const { return last; }
+    size_t size() const { return static_cast<size_t>(last - first); }
+    bool empty() const { return first == last; }
+    T& operator[](size_t i) const { return first[i]; }
+};
+
+/* A list of values per interval, stored compressed-sparse-row style: the
+values of every interval back to back in one buffer, plus the offset at
+which each interval starts. The values of interval i are
+values[offsets[i]] .. values[offsets[i + 1] - 1]. Compared to a vector of
+vectors this is two allocations for a whole chart instead of one per
+interval, and walking all intervals in order is a linear scan.
+
+Fill it with Reset(), then Append() in non-decreasing interval order,
+then Finish(). */
+template <typename T>
+class IntervalList
+{
+public:
+    std::vector<T> values;
+    std::vector<size_t> offsets; // size() + 1 entries once finished
+
+    // Empties the list and prepares it for `intervals` intervals. Keeps the
+    // allocated memory.
+    void Reset(size_t intervals) {
+        values.clear();
+        offsets.clear();
+        offsets.reserve(intervals + 1);
+        offsets.push_back(0);
+        num_intervals = intervals;
+    }
+
+    // Adds a value to interval i, which can't be before the interval of
+    // the last value added
+    void Append(size_t i, const T& value) {
+        while (offsets.size() <= i)
+            offsets.push_back(values.size());
+        values.push_back(value);
+    }
+
+    // Closes the intervals after the last one appended to
+    void Finish() {
+        while (offsets.size() <= num_intervals)
+            offsets.push_back(values.size());
+    }
+
+    // Number of intervals
+    size_t size() const { return num_intervals; }
+
+    IntervalRange<T> operator[](size_t i) {
+        return IntervalRange<T> {values.data() + offsets[i], values.data() + offsets[i + 1]};
+    }
+    IntervalRange<const T> operator[](size_t i) const {
+        return IntervalRange<const T> {values.data() + offsets[i], values.data() + offsets[i + 1]};
+    }
+
+private:
+    size_t num_intervals = 0;
+};
+
+#endif //MINACALC_INTERVALLIST_H
@@ -1,20 +1,38 @@
+#include "alloccounter.h"
+#include "batch.h"
 #include "minacalc.h"
 #include "smloader.h"
 #include "solocalc.h"
+#include "threadpool.h"
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 
 using std::cout;
 using std::endl;
 
+// Parses the argument of --threads into `threads`; false if it isn't 0 to
+// MAX_POOL_THREADS
+bool parseThreads(const char* arg, unsigned int& threads) {
+    char* end;
+    long value = std::strtol(arg, &end, 10);
+    if (end == arg || *end != '\0' || value < 0 || value > static_cast<long>(MAX_POOL_THREADS)) {
+        std::cerr << "--threads takes 0 (one per hardware thread) to " << MAX_POOL_THREADS << ", not " << arg << endl;
+        return false;
+    }
+    threads = static_cast<unsigned int>(value);
+    return true;
+}
+
 void printDifficulty(const ChartRating& rating) {
-    cout << rating.difficultyName << ":" << endl;
-    cout << "Overall: " << rating.rating.overall << endl;
-    cout << "Stream: " << rating.rating.stream << endl;
-    cout << "JumpStream: " << rating.rating.jumpstream << endl;
-    cout << "HandStream: " << rating.rating.handstream << endl;
-    cout << "Stamina: " << rating.rating.stamina << endl;
-    cout << "Jackspeed: " << rating.rating.jack << endl;
-    cout << "Chordjack: " << rating.rating.chordjack << endl;
+    cout << rating.difficultyName << ":\n";
+    cout << "Overall: " << rating.rating.overall << '\n';
+    cout << "Stream: " << rating.rating.stream << '\n';
+    cout << "JumpStream: " << rating.rating.jumpstream << '\n';
+    cout << "HandStream: " << rating.rating.handstream << '\n';
+    cout << "Stamina: " << rating.rating.stamina << '\n';
+    cout << "Jackspeed: " << rating.rating.jack << '\n';
+    cout << "Chordjack: " << rating.rating.chordjack << '\n';
     cout << "Technical: " << rating.rating.technical;
 }
 
@@ -35,7 +53,107 @@ std::vector<ChartRating> difficultyFromFile(const std::string& location) {
     return rating;
 }
 
+// minacalc --batch <directory> [--threads N] [--fast-points] [--sorted-points]
+//          [--search linear|bisect|illinois] [--probes N]
+//          [--rating-cache <file>] [--stats <file>]
+// minacalc --batch <directory or .sm> --profile [--fast-points] [--sorted-points] [--search ...]:
+//          hardware counters per phase and chart instead of ratings
+// minacalc --batch --cache <cache file> [same options]
+// minacalc --batch <directory> --cache <cache file> [same options]: updates
+//          the cache from the directory first
+int batchMain(int argc, char *argv[]) {
+    BatchOptions options;
+    options.thread_allocations = thread_allocations;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+            options.cache = argv[++i];
+        else if (strcmp(argv[i], "--rating-cache") == 0 && i + 1 < argc)
+            options.rating_cache = argv[++i];
+        else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc) {
+            if (!CALC_STATS_ENABLED) {
+                std::cerr << "--stats needs a build with -DMINACALC_STATS=ON" << endl;
+                return 1;
+            }
+            options.stats = argv[++i];
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            if (!parseThreads(argv[++i], options.threads))
+                return 1;
+        }
+        else if (strcmp(argv[i], "--profile") == 0)
+            options.profile = true;
+        else if (strcmp(argv[i], "--fast-points") == 0)
+            options.calc.fast_points = true;
+        else if (strcmp(argv[i], "--sorted-points") == 0)
+            options.calc.sorted_points = true;
+        else if (strcmp(argv[i], "--probes") == 0 && i + 1 < argc) {
+            const char* probes = argv[++i];
+            char* end;
+            long value = std::strtol(probes, &end, 10);
+            if (end == probes || *end != '\0' || value < 1 || value > MAX_PROBES) {
+                std::cerr << "--probes takes 1 to " << MAX_PROBES << ", not " << probes << endl;
+                return 1;
+            }
+            options.calc.probes = static_cast<int>(value);
+        }
+        else if (strcmp(argv[i], "--search") == 0 && i + 1 < argc) {
+            const char* mode = argv[++i];
+            if (strcmp(mode, "linear") == 0)
+                options.calc.search = LINEAR_SEARCH;
+            else if (strcmp(mode, "bisect") == 0)
+                options.calc.search = BISECT_SEARCH;
+            else if (strcmp(mode, "illinois") == 0)
+                options.calc.search = ILLINOIS_SEARCH;
+            else {
+                std::cerr << "unknown search mode " << mode << endl;
+                return 1;
+            }
+        }
+        else if (options.root.empty())
+            options.root = argv[i];
+        else {
+            std::cerr << "unexpected argument " << argv[i] << endl;
+            return 1;
+        }
+    }
+    if ((options.root.empty() && options.cache.empty()) || (options.profile && options.root.empty())) {
+        std::cerr << "usage: minacalc --batch [<directory>] [--cache <cache file>] [--threads N] [--fast-points] [--sorted-points] [--search linear|bisect|illinois] [--probes N] [--rating-cache <file>] [--stats <file>] [--profile]" << endl;
+        return 1;
+    }
+    return batchRate(options);
+}
+
+// minacalc --convert <directory> <cache file> [--threads N]
+// Updates the cache if it exists, only parsing files that changed
+int convertMain(int argc, char *argv[]) {
+    BatchOptions options;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            if (!parseThreads(argv[++i], options.threads))
+                return 1;
+        }
+        else if (options.root.empty())
+            options.root = argv[i];
+        else if (options.cache.empty())
+            options.cache = argv[i];
+        else {
+            std::cerr << "unexpected argument " << argv[i] << endl;
+            return 1;
+        }
+    }
+    if (options.cache.empty()) {
+        std::cerr << "usage: minacalc --convert <directory> <cache file> [--threads N]" << endl;
+        return 1;
+    }
+    return batchConvert(options);
+}
+
 int main(int argc, char *argv[]) {
+    if (argc > 1 && strcmp(argv[1], "--batch") == 0)
+        return batchMain(argc, argv);
+    if (argc > 1 && strcmp(argv[1], "--convert") == 0)
+        return convertMain(argc, argv);
+
     std::vector<ChartRating> rating;
     if (argc > 2) {
         cout << "Solo Difficulty: ";
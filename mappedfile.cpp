@@ -0,0 +1,97 @@
+#include "mappedfile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+    Close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::Open(const std::string& path) {
+    Close();
+    HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE)
+        return false;
+    file = handle;
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(handle, &file_size)) {
+        Close();
+        return false;
+    }
+    if (file_size.QuadPart == 0)
+        return true;
+
+    mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr) {
+        Close();
+        return false;
+    }
+    bytes = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (bytes == nullptr) {
+        Close();
+        return false;
+    }
+    length = static_cast<size_t>(file_size.QuadPart);
+    return true;
+}
+
+void MappedFile::Close() {
+    if (bytes != nullptr)
+        UnmapViewOfFile(bytes);
+    if (mapping != nullptr)
+        CloseHandle(mapping);
+    if (file != nullptr)
+        CloseHandle(file);
+    bytes = nullptr;
+    length = 0;
+    mapping = nullptr;
+    file = nullptr;
+}
+
+#else
+
+bool MappedFile::Open(const std::string& path) {
+    Close();
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        return false;
+    }
+    if (info.st_size > 0) {
+        void* mapped = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        bytes = static_cast<const unsigned char*>(mapped);
+        length = static_cast<size_t>(info.st_size);
+    }
+    // The mapping stays valid after the descriptor is closed
+    close(fd);
+    return true;
+}
+
+void MappedFile::Close() {
+    if (bytes != nullptr)
+        munmap(const_cast<unsigned char*>(bytes), length);
+    bytes = nullptr;
+    length = 0;
+}
+
+#endif
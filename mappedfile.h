@@ -0,0 +1,34 @@
+#ifndef MINACALC_MAPPEDFILE_H
+#define MINACALC_MAPPEDFILE_H
+
+#include <cstddef>
+#include <string>
+
+// A read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Maps the file, dropping any earlier mapping. Returns false if the
+    // file can't be opened or mapped. An empty file maps to size() 0.
+    bool Open(const std::string& path);
+    void Close();
+
+    const unsigned char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    const unsigned char* bytes = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    void* file = nullptr;
+    void* mapping = nullptr;
+#endif
+};
+
+#endif //MINACALC_MAPPEDFILE_H
@@ -1,5 +1,9 @@
 #include "minacalc.h"
+#include "calckernels.h"
+#include "threadpool.h"
+#include <chrono>
 #include <cmath>
+#include <cstring>
 #include <iostream>
 #include <algorithm>
 #include <memory>
@@ -15,26 +19,296 @@ using std::max;
 using std::sqrt;
 using std::pow;
 
+#ifdef MINACALC_STATS
+// Adds the wall time until the end of its scope to a CalcStats phase
+class CalcStatsTimer
+{
+public:
+    explicit CalcStatsTimer(double& seconds) : seconds(seconds), start(std::chrono::steady_clock::now()) {}
+    ~CalcStatsTimer() {
+        seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+private:
+    double& seconds;
+    std::chrono::steady_clock::time_point start;
+};
+
+// Only for use in Calc members
+#define CALC_STATS_TIMER(phase) CalcStatsTimer calc_stats_timer(stats.seconds[phase])
+#define CALC_STATS_COUNT(counter, n) (stats.counter += (n))
+#else
+#define CALC_STATS_TIMER(phase) ((void)0)
+#define CALC_STATS_COUNT(counter, n) ((void)0)
+#endif
+
+// Tells the observer, if there is one, about a phase for the rest of the scope
+class ObservedPhase
+{
+public:
+    ObservedPhase(CalcObserver* observer, CalcPhase phase) : observer(observer), phase(phase) {
+        if (observer)
+            observer->PhaseBegin(phase);
+    }
+    ~ObservedPhase() {
+        if (observer)
+            observer->PhaseEnd(phase);
+    }
+
+private:
+    CalcObserver* observer;
+    CalcPhase phase;
+};
+
 template<typename T>
 T CalcClamp(T x, T l, T h) {
     return x > h ? h : (x < l ? l : x);
 }
 
+/* Finds roughly the lowest value at which `residual` stops being negative,
+e.g. the player skill at which the score goal is reached. `residual` should
+be increasing; NaN counts as not negative.
+
+LINEAR_SEARCH walks up from `value` in steps of `resolution` while the
+residual is negative, steps back, halves the step and repeats `num_iters`
+times. The result is the first value found not to be negative at the last
+step size, so the crossing lies within resolution / 2^(num_iters - 1)
+below it.
+
+The bracketed modes keep that precision as their tolerance. They walk up
+in steps of `resolution` as well (or down, at most two steps, if `value`
+already isn't negative), then shrink the bracket by
+bisection or by Illinois regula falsi until it's no wider than the
+tolerance, and return its upper end. Regula falsi probes are kept at
+least half the tolerance inside the bracket so it can't stall on one side,
+and a regula falsi step that doesn't halve the bracket is followed by a
+bisection step.
+They stop early after `max_evals` evaluations and return the upper end of
+the bracket, or the next step up if the walk up hadn't reached the goal
+yet.
+
+With `limit_at_100`, every mode gives up once it has passed 100 while still
+below the goal and returns where it is. Each call of `residual` is counted
+in `evaluations`. */
 template <typename F>
-float approximate(float value, float resolution, int num_iters, F is_too_low, bool limit_at_100 = false) {
-    for (int i = 0; i < num_iters; i++) {
-        while (is_too_low(value)) {
-            if (limit_at_100 && value > 100.f) return value;
-            value += resolution;
+float approximate(float value, float resolution, int num_iters, F residual, const CalcOptions& options,
+                  int& evaluations, bool limit_at_100 = false) {
+    auto is_too_low = [&](float x) {
+        ++evaluations;
+        return residual(x) < 0.f;
+    };
+
+    if (options.search == LINEAR_SEARCH) {
+        for (int i = 0; i < num_iters; i++) {
+            while (is_too_low(value)) {
+                if (limit_at_100 && value > 100.f) return value;
+                value += resolution;
+            }
+            value -= resolution;
+            resolution /= 2.f;
         }
-        value -= resolution;
-        resolution /= 2.f;
+
+        return value + 2.f * resolution;
     }
-    
-    return value + 2.f * resolution;
+
+    const float tolerance = resolution / static_cast<float>(1 << (num_iters - 1));
+    const int max_evals = evaluations + options.search_max_evals;
+
+    // Bracket the crossing: residual(lo) < 0 <= residual(hi)
+    float lo = value;
+    float hi = value;
+    float r_lo = 0.f;
+    float r_hi = 0.f;
+
+    ++evaluations;
+    r_lo = residual(lo);
+    if (!(r_lo < 0.f)) {
+        // Already at the goal. The linear search ends up at most two
+        // steps below `value`, so look no further than that either.
+        for (int step = 0; !(r_lo < 0.f); step++) {
+            hi = lo;
+            r_hi = r_lo;
+            if (step == 2 || evaluations >= max_evals)
+                return hi;
+            lo = hi - resolution;
+            ++evaluations;
+            r_lo = residual(lo);
+        }
+    } else {
+        for (;;) {
+            if (limit_at_100 && lo > 100.f) return lo;
+            // Out of evaluations before the goal was bracketed: the next
+            // step is the best guess at an upper end there is
+            if (evaluations >= max_evals) return lo + resolution;
+            hi = lo + resolution;
+            ++evaluations;
+            r_hi = residual(hi);
+            if (!(r_hi < 0.f))
+                break;
+            lo = hi;
+            r_lo = r_hi;
+        }
+    }
+
+    // Which end the last probe replaced, for the Illinois fix
+    int last_side = 0;
+    bool bisect_next = false;
+    while (hi - lo > tolerance && evaluations < max_evals) {
+        float width = hi - lo;
+        float probe = (lo + hi) / 2.f;
+        bool falsi = options.search == ILLINOIS_SEARCH && !bisect_next &&
+                     std::isfinite(r_lo) && std::isfinite(r_hi) && r_hi > r_lo;
+        if (falsi) {
+            probe = (lo * r_hi - hi * r_lo) / (r_hi - r_lo);
+            probe = CalcClamp(probe, lo + tolerance / 2.f, hi - tolerance / 2.f);
+        }
+
+        ++evaluations;
+        float r = residual(probe);
+        if (r < 0.f) {
+            lo = probe;
+            r_lo = r;
+            if (last_side < 0)
+                r_hi /= 2.f;
+            last_side = -1;
+        } else {
+            hi = probe;
+            r_hi = r;
+            if (last_side > 0)
+                r_lo /= 2.f;
+            last_side = 1;
+        }
+
+        // Very lopsided residuals (AggregateScores' can reach 1e30) make
+        // regula falsi crawl; bisect whenever it didn't halve the bracket
+        bisect_next = falsi && hi - lo > width / 2.f;
+    }
+    return hi;
+}
+
+/* approximate() for a `residuals(xs, count, rs)` that scores several values
+in one go (count at most MAX_PROBES), options.probes at a time. Every
+value scored counts as an evaluation.
+
+LINEAR_SEARCH scores the next `probes` steps of each walk up at once and
+carries on from the first whose residual isn't negative, so it makes the
+same steps and returns exactly what approximate() returns; the steps past
+that one are wasted. A value it already knows to be too low isn't scored
+again.
+
+The bracketed modes walk up the same way to find the bracket (trying the
+two steps down first if `value` already isn't negative, like
+approximate()). Then each pass splits the bracket into probes + 1 equal
+parts and keeps the one where the residual stops being negative, until
+it's no wider than the tolerance; ILLINOIS_SEARCH does that too. They stop
+after the pass that reaches `max_evals` and return the upper end, or the
+next step up during the walk up, like approximate(). */
+template <typename F>
+float approximate_probes(float value, float resolution, int num_iters, F residuals, const CalcOptions& options,
+                         int& evaluations, bool limit_at_100 = false) {
+    const int probes = CalcClamp(options.probes, 1, MAX_PROBES);
+    float xs[MAX_PROBES];
+    float rs[MAX_PROBES];
+    auto score = [&](int count) {
+        evaluations += count;
+        residuals(xs, static_cast<size_t>(count), rs);
+    };
+    // Fills in the walk up from `x`
+    auto steps_from = [&](float x) {
+        xs[0] = x;
+        for (int j = 1; j < probes; j++)
+            xs[j] = xs[j - 1] + resolution;
+    };
+
+    if (options.search == LINEAR_SEARCH) {
+        // The last value found to be too low. A walk after a step back
+        // usually starts on it, and then it isn't scored again.
+        bool any_too_low = false;
+        float last_too_low = 0.f;
+        for (int i = 0; i < num_iters; i++) {
+            for (;;) {
+                if (any_too_low && value == last_too_low) {
+                    if (limit_at_100 && value > 100.f) return value;
+                    value += resolution;
+                }
+                steps_from(value);
+                score(probes);
+                int j = 0;
+                for (; j < probes && rs[j] < 0.f; j++) {
+                    if (limit_at_100 && xs[j] > 100.f) return xs[j];
+                    any_too_low = true;
+                    last_too_low = xs[j];
+                }
+                if (j < probes) {
+                    value = xs[j];
+                    break;
+                }
+                value = last_too_low;
+            }
+            value -= resolution;
+            resolution /= 2.f;
+        }
+
+        return value + 2.f * resolution;
+    }
+
+    const float tolerance = resolution / static_cast<float>(1 << (num_iters - 1));
+    const int max_evals = evaluations + options.search_max_evals;
+
+    // Bracket the crossing: residual(lo) < 0 <= residual(hi)
+    float lo = value;
+    float hi = value;
+    steps_from(value);
+    score(probes);
+    if (!(rs[0] < 0.f)) {
+        // Already at the goal; at most two steps down, as in approximate()
+        xs[0] = value - resolution;
+        xs[1] = xs[0] - resolution;
+        score(2);
+        if (rs[0] < 0.f) {
+            lo = xs[0];
+        } else if (rs[1] < 0.f) {
+            lo = xs[1];
+            hi = xs[0];
+        } else {
+            return xs[1];
+        }
+    } else {
+        for (;;) {
+            int j = 0;
+            for (; j < probes && rs[j] < 0.f; j++) {
+                if (limit_at_100 && xs[j] > 100.f) return xs[j];
+                lo = xs[j];
+            }
+            if (j < probes) {
+                hi = xs[j];
+                break;
+            }
+            if (evaluations >= max_evals) return lo + resolution;
+            steps_from(lo + resolution);
+            score(probes);
+        }
+    }
+
+    while (hi - lo > tolerance && evaluations < max_evals) {
+        float width = hi - lo;
+        for (int j = 0; j < probes; j++)
+            xs[j] = lo + width * static_cast<float>(j + 1) / static_cast<float>(probes + 1);
+        score(probes);
+        int j = 0;
+        for (; j < probes && rs[j] < 0.f; j++)
+            lo = xs[j];
+        if (j < probes)
+            hi = xs[j];
+    }
+    return hi;
 }
 
-inline float mean(const vector<float>& v) {
+// The skillsets of a DifficultyRating in its order, see skillsets()
+typedef std::array<float, 8> Skillsets;
+
+template <typename Container>
+inline float mean(const Container& v) {
     return std::accumulate(begin(v), end(v), 0.f) / v.size();
 }
 
@@ -84,15 +358,17 @@ inline void DifficultyMSSmooth(vector<float>& input) {
 
 // Returns approximately the skillset rating plus 0.609 (That number
 // varies a little depending on the variations of the skillsets)
-inline float AggregateScores(const vector<float>& skillsets, float rating, float resolution) {
-    auto check_if_too_low = [skillsets](float rating) {
+inline float AggregateScores(const Skillsets& skillsets, float rating, float resolution,
+                             const CalcOptions& options, int& evaluations) {
+    // Too low while the sum is above 3
+    auto residual = [skillsets](float rating) {
         float sum = 0.0f;
         for (float i : skillsets) {
             sum += 2.f / std::erfc(0.5f * (i - rating)) - 1.f;
         }
-        return 3 < sum;
+        return 3 - sum;
     };
-    return approximate(rating, resolution, 11, check_if_too_low);
+    return approximate(rating, resolution, 11, residual, options, evaluations);
 }
 
 // Converts a row byte into the number of taps present in the row
@@ -100,64 +376,166 @@ unsigned int column_count(unsigned int note) {
     return note % 2 + note / 2 % 2 + note / 4 % 2 + note / 8 % 2;
 }
 
-// Proportion of how many taps belong to chords of size `chord_size`
-float chord_proportion(const vector<NoteInfo>& NoteInfo, const int chord_size) {
-    unsigned int taps = 0;
-    unsigned int chords = 0;
+PreparedChart::PreparedChart(const vector<NoteInfo>& note_info) {
+    Assign(note_info);
+}
 
-    for (auto row : NoteInfo) {
-        unsigned int notes = column_count(row.notes);
-        taps += notes;
-        if (notes == chord_size)
-            chords += notes;
-    }
+void PreparedChart::Assign(const vector<NoteInfo>& note_info) {
+    Clear();
+    if (note_info.empty())
+        return;
+    row_notes.reserve(note_info.size());
+    row_times.reserve(note_info.size());
+    row_taps.reserve(note_info.size());
+
+    for (const NoteInfo& row : note_info)
+        AddRow(row);
+    Finish();
+}
 
-    return static_cast<float>(chords) / static_cast<float>(taps);
+void PreparedChart::Clear() {
+    row_notes.clear();
+    row_times.clear();
+    row_taps.clear();
+    column_taps = {};
+    last_row_time = 0.f;
+    jump_proportion = hand_proportion = quad_proportion = 0.f;
+    taps = 0;
+    std::fill(chord_taps, chord_taps + 5, 0u);
 }
 
-vector<float> skillset_vector(const DifficultyRating& difficulty) {
-    return vector<float> {difficulty.overall,
-                          difficulty.stream,
-                          difficulty.jumpstream,
-                          difficulty.handstream,
-                          difficulty.stamina,
-                          difficulty.jack,
-                          difficulty.chordjack,
-                          difficulty.technical
+void PreparedChart::AddRow(const NoteInfo& row) {
+    last_row_time = row.rowTime;
+    if (row.notes == 0)
+        return;
+
+    unsigned int notes = column_count(row.notes);
+    taps += notes;
+    if (notes <= 4)
+        chord_taps[notes] += notes;
+
+    row_notes.push_back(row.notes);
+    row_times.push_back(row.rowTime);
+    row_taps.push_back(notes);
+
+    for (unsigned int t = 0; t < column_taps.size(); t++)
+        if (row.notes & (1u << t))
+            column_taps[t]++;
+}
+
+size_t PreparedChart::InsertRow(const NoteInfo& row) {
+    auto position = std::upper_bound(row_times.begin(), row_times.end(), row.rowTime);
+    auto index = static_cast<size_t>(position - row_times.begin());
+    unsigned int notes = column_count(row.notes);
+    taps += notes;
+    if (notes <= 4)
+        chord_taps[notes] += notes;
+
+    row_notes.insert(row_notes.begin() + index, row.notes);
+    row_times.insert(position, row.rowTime);
+    row_taps.insert(row_taps.begin() + index, notes);
+    for (unsigned int t = 0; t < column_taps.size(); t++)
+        if (row.notes & (1u << t))
+            column_taps[t]++;
+
+    last_row_time = row_times.back();
+    Finish();
+    return index;
+}
+
+void PreparedChart::RemoveRow(size_t index) {
+    unsigned int notes = row_taps[index];
+    taps -= notes;
+    if (notes <= 4)
+        chord_taps[notes] -= notes;
+    for (unsigned int t = 0; t < column_taps.size(); t++)
+        if (row_notes[index] & (1u << t))
+            column_taps[t]--;
+
+    row_notes.erase(row_notes.begin() + index);
+    row_times.erase(row_times.begin() + index);
+    row_taps.erase(row_taps.begin() + index);
+
+    last_row_time = row_times.empty() ? 0.f : row_times.back();
+    Finish();
+}
+
+void PreparedChart::Finish() {
+    // Nothing to rate, see empty()
+    if (row_notes.empty())
+        return;
+    jump_proportion = static_cast<float>(chord_taps[2]) / static_cast<float>(taps);
+    hand_proportion = static_cast<float>(chord_taps[3]) / static_cast<float>(taps);
+    quad_proportion = static_cast<float>(chord_taps[4]) / static_cast<float>(taps);
+}
+
+Skillsets skillsets(const DifficultyRating& difficulty) {
+    return Skillsets {difficulty.overall,
+                      difficulty.stream,
+                      difficulty.jumpstream,
+                      difficulty.handstream,
+                      difficulty.stamina,
+                      difficulty.jack,
+                      difficulty.chordjack,
+                      difficulty.technical
     };
 }
 
+void SearchStats::Add(const SearchStats& other) {
+    for (int i = 0; i < NUM_CHISELS; i++)
+        chisel[i] += other.chisel[i];
+    aggregate += other.aggregate;
+}
+
+int SearchStats::Total() const {
+    return std::accumulate(chisel, chisel + NUM_CHISELS, aggregate);
+}
+
+const char* CalcStats::PhaseName(int phase) {
+    static const char* const names[NUM_PHASES] = {
+        "CalcMain", "Init", "ProcessRows", "InitHand", "OHJumpDownscaler", "Anchorscaler",
+        "RollDownscaler", "HSDownscaler", "JumpDownscaler", "CalculateFingerbias",
+        "Chisel STREAM", "Chisel JS", "Chisel HS", "Chisel TECH", "Chisel JACK", "Chisel stamina"
+    };
+    return phase >= 0 && phase < NUM_PHASES ? names[phase] : "unknown";
+}
+
+void CalcStats::Add(const CalcStats& other) {
+    for (int i = 0; i < NUM_PHASES; i++)
+        seconds[i] += other.seconds[i];
+    for (int i = 0; i < NUM_CHISELS; i++)
+        score_calls[i] += other.score_calls[i];
+    jack_loss_calls += other.jack_loss_calls;
+    stam_adjust_calls += other.stam_adjust_calls;
+    calculations += other.calculations;
+    intervals += other.intervals;
+    reserved_bytes = max(reserved_bytes, other.reserved_bytes);
+}
+
+unsigned long long CalcStats::ScoreCalls() const {
+    return std::accumulate(score_calls, score_calls + NUM_CHISELS, 0ull);
+}
+
 float highest_difficulty(const DifficultyRating& difficulty) {
     auto v = {difficulty.stream,difficulty.jumpstream,difficulty.handstream,difficulty.stamina,difficulty.jack,
               difficulty.chordjack,difficulty.technical};
     return *std::max_element(v.begin(), v.end());
 }
 
-void Calc::Init(const vector<NoteInfo>& note_info, float music_rate, float score_goal) {
-    numitv = static_cast<int>(std::ceil(note_info.back().rowTime / (music_rate * IntervalSpan)));
-
-    // Calculate nervIntervals
-    nervIntervals = vector<vector<int>>(numitv, vector<int>());
-    int interval_i = 0;
-    for (size_t i = 0; i < note_info.size(); i++) {
-        float scaledtime = note_info[i].rowTime / music_rate;
-
-        while (scaledtime > static_cast<float>(interval_i + 1) * IntervalSpan)
-            ++interval_i;
+void Calc::Init(const PreparedChart& chart, float music_rate) {
+    CALC_STATS_TIMER(CalcStats::INIT);
+    numitv = static_cast<int>(std::ceil(chart.last_row_time / (music_rate * IntervalSpan)));
+    // A chart whose only row is at 0s still has one interval
+    numitv = max(numitv, 1);
 
-        if (note_info[i].notes != 0) {
-            nervIntervals[interval_i].push_back(i);
-        }
-    }
+    ProcessRows(chart, music_rate);
     
-    InitHand(left_hand, note_info, 0, 1, music_rate);
-    InitHand(right_hand, note_info, 2, 3, music_rate);
+    InitHand(left_hand, 0, 1);
+    InitHand(right_hand, 2, 3);
+    InitTotals();
+}
 
-    j0 = SequenceJack(note_info, 0, music_rate);
-    j1 = SequenceJack(note_info, 1, music_rate);
-    j2 = SequenceJack(note_info, 2, music_rate);
-    j3 = SequenceJack(note_info, 3, music_rate);
-    
+void Calc::InitTotals() {
     // Calculate total max points
     MaxPoints = 0;
     for (size_t i = 0; i < left_hand.v_itvpoints.size(); i++)
@@ -167,22 +545,27 @@ void Calc::Init(const vector<NoteInfo>& note_info, float music_rate, float score
     fingerbias = 1 + left_hand.fingerbias + right_hand.fingerbias;
     // Fingerbias is a sum of fingerbiases per interval per hand, so
     // dividing it like this makes it an average
-    fingerbias /= 2 * nervIntervals.size();
+    fingerbias /= 2 * itv_counts.size();
 }
 
-void Calc::InitHand(Hand& hand, const vector<NoteInfo>& note_info, int f1, int f2, float music_rate) {
-    Finger finger1 = ProcessFinger(note_info, f1, music_rate);
-    Finger finger2 = ProcessFinger(note_info, f2, music_rate);
+void Calc::InitHand(Hand& hand, int f1, int f2) {
+    CALC_STATS_TIMER(CalcStats::INIT_HAND);
+    Finger& finger1 = fingers[f1];
+    Finger& finger2 = fingers[f2];
     
     hand.InitDiff(finger1, finger2);
     hand.InitPoints(finger1, finger2);
     
-    hand.ohjumpscale = OHJumpDownscaler(note_info, 1 << f1, 1 << f2);
-    hand.anchorscale = Anchorscaler(note_info, 1 << f1, 1 << f2);
-    hand.rollscale = RollDownscaler(finger1, finger2);
-    hand.hsscale = HSDownscaler(note_info);
-    hand.jumpscale = JumpDownscaler(note_info);
-    hand.fingerbias = CalculateFingerbias(note_info, 1 << f1, 1 << f2);
+    OHJumpDownscaler(f1 / 2, hand.ohjumpscale);
+    Anchorscaler(f1, f2, hand.anchorscale);
+    RollDownscaler(finger1, finger2, hand.rollscale);
+    HSDownscaler(hand.hsscale);
+    JumpDownscaler(hand.jumpscale);
+    hand.fingerbias = CalculateFingerbias(f1, f2);
+    hand.fast_points = options.fast_points;
+    hand.sorted_points = options.sorted_points;
+    hand.InitChiselDiffs();
+    hand.InitSortedPoints();
 }
 
 // Linear interpolation, for example:
@@ -198,34 +581,71 @@ float transform(float value, float start_x, float start_y, float end_x, float en
 }
 
 DifficultyRating Calc::CalcMain(const vector<NoteInfo>& NoteInfo, float music_rate, float score_goal) {
-    Init(NoteInfo, music_rate, score_goal);
+    return CalcMain(PreparedChart(NoteInfo), music_rate, score_goal);
+}
+
+DifficultyRating Calc::CalcMain(const PreparedChart& chart, float music_rate, float score_goal) {
+#ifdef MINACALC_STATS
+    stats = CalcStats();
+    stats.calculations = 1;
+#endif
+    CALC_STATS_TIMER(CalcStats::CALC_MAIN);
+    {
+        ObservedPhase phase(options.observer, INIT_PHASE);
+        Init(chart, music_rate);
+    }
+    return CalcRatings(chart, score_goal);
+}
+
+DifficultyRating Calc::CalcRatings(const PreparedChart& chart, float score_goal) {
+    CALC_STATS_COUNT(intervals, static_cast<unsigned long long>(numitv));
+#ifdef MINACALC_STATS
+    stats.reserved_bytes = ReservedBytes();
+#endif
     DifficultyRating difficulty {0, 0, 0, 0, 0, 0, 0, 0};
+    evaluations = SearchStats();
     
-    float last_row_time = NoteInfo.back().rowTime;
+    float last_row_time = chart.last_row_time;
     
     float grindscaler = transform(last_row_time, 30, 0.93, 60, 1);
     grindscaler *= transform(last_row_time, 14.653846, 0.87, 29.653846, 1);
     
     float shortstamdownscaler = transform(last_row_time, 150, 0.9, 300, 1);
     
-    float jprop = chord_proportion(NoteInfo, 2);
+    float jprop = chart.jump_proportion;
     float nojumpsdownscaler = transform(jprop, 0, 0.9, 0.5, 1);
     float manyjumpsdownscaler = transform(jprop, 0.43, 1, 0.58, 0.85);
 
-    float hprop = chord_proportion(NoteInfo, 3);
+    float hprop = chart.hand_proportion;
     float nohandsdownscaler = transform(hprop, 0, 0.95, 0.25, 1);
     float allhandsdownscaler = transform(hprop, 0.23, 1, 0.38, 0.85);
 
-    float qprop = chord_proportion(NoteInfo, 4);
+    float qprop = chart.quad_proportion;
     float lotquaddownscaler = transform(qprop, 0.13, 1, 0.28, 0.85);
 
     float jumpthrill = transform(jprop + hprop, 0.625, 1, 0.775, 0.85);
 
-    difficulty.stream = Chisel(0.1f, 10.24f, score_goal, STREAM, false);
-    difficulty.jumpstream = Chisel(0.1f, 10.24f, score_goal, JS, false);
-    difficulty.handstream = Chisel(0.1f, 10.24f, score_goal, HS, false);
-    difficulty.technical = Chisel(0.1f, 10.24f, score_goal, TECH, false);
-    difficulty.jack = Chisel(0.1f, 10.24f, score_goal, JACK, false);
+    // These don't depend on each other and only read the state Init
+    // set up, so they can run concurrently if we were given an executor
+    const ChiselType skillset_types[] = {STREAM, JS, HS, TECH, JACK};
+    float skillset_ratings[5];
+    auto chisel_skillset = [&](size_t i) {
+        skillset_ratings[i] = Chisel(0.1f, 10.24f, score_goal, skillset_types[i], false);
+    };
+    {
+        ObservedPhase phase(options.observer, SKILLSET_PHASE);
+        if (options.executor)
+            options.executor(5, chisel_skillset);
+        else
+            for (size_t i = 0; i < 5; i++)
+                chisel_skillset(i);
+    }
+
+    difficulty.stream = skillset_ratings[0];
+    difficulty.jumpstream = skillset_ratings[1];
+    difficulty.handstream = skillset_ratings[2];
+    difficulty.technical = skillset_ratings[3];
+    difficulty.jack = skillset_ratings[4];
 
     float techbase = max(difficulty.stream, difficulty.jack);
     difficulty.technical *= CalcClamp(difficulty.technical / techbase, 0.85f, 1.f);
@@ -233,14 +653,17 @@ DifficultyRating Calc::CalcMain(const vector<NoteInfo>& NoteInfo, float music_ra
     // Derive stamina rating from either stream, js, hs or tech,
     // depending on which is the highest.
     float max_stream_js_hs_tech = max(max(difficulty.stream, difficulty.jumpstream), max(difficulty.handstream, difficulty.technical));
-    if (max_stream_js_hs_tech == difficulty.stream) {
-        difficulty.stamina = Chisel(difficulty.stream - 0.1f, 2.56f, score_goal, STREAM, true);
-    } else if (max_stream_js_hs_tech == difficulty.jumpstream) {
-        difficulty.stamina = Chisel(difficulty.jumpstream - 0.1f, 2.56f, score_goal, JS, true);
-    } else if (max_stream_js_hs_tech == difficulty.handstream) {
-        difficulty.stamina = Chisel(difficulty.handstream - 0.1f, 2.56f, score_goal, HS, true);
-    } else { // tech is highest
-        difficulty.stamina = Chisel(difficulty.technical - 0.1f, 2.56f, score_goal, TECH, true);
+    {
+        ObservedPhase phase(options.observer, STAMINA_PHASE);
+        if (max_stream_js_hs_tech == difficulty.stream) {
+            difficulty.stamina = Chisel(difficulty.stream - 0.1f, 2.56f, score_goal, STREAM, true);
+        } else if (max_stream_js_hs_tech == difficulty.jumpstream) {
+            difficulty.stamina = Chisel(difficulty.jumpstream - 0.1f, 2.56f, score_goal, JS, true);
+        } else if (max_stream_js_hs_tech == difficulty.handstream) {
+            difficulty.stamina = Chisel(difficulty.handstream - 0.1f, 2.56f, score_goal, HS, true);
+        } else { // tech is highest
+            difficulty.stamina = Chisel(difficulty.technical - 0.1f, 2.56f, score_goal, TECH, true);
+        }
     }
 
     difficulty.jumpstream *= 0.95f;
@@ -300,14 +723,14 @@ DifficultyRating Calc::CalcMain(const vector<NoteInfo>& NoteInfo, float music_ra
         difficulty.stream -= sqrt(max_js_hs - difficulty.stream);
 
     // Set first overall rating
-    float overall = AggregateScores(skillset_vector(difficulty), 0.f, 10.24f);
+    float overall = AggregateScores(skillsets(difficulty), 0.f, 10.24f, options, evaluations.aggregate);
     difficulty.overall = downscale_low_accuracy_scores(overall, score_goal);
 
     // Cap all skillsets at 120% of the average, except stream/js/
     // technical, those are capped at 125%.
     // Also apply grindscaler to all of them.
     // And downscale_low_accuracy_scores them, too.
-    float aDvg = mean(skillset_vector(difficulty));
+    float aDvg = mean(skillsets(difficulty));
     difficulty.overall = downscale_low_accuracy_scores(min(difficulty.overall, aDvg * 1.2f) * grindscaler, score_goal);
     difficulty.stream = downscale_low_accuracy_scores(min(difficulty.stream, aDvg * 1.25f) * grindscaler, score_goal);
     difficulty.jumpstream = downscale_low_accuracy_scores(min(difficulty.jumpstream, aDvg * 1.25f) * grindscaler, score_goal);
@@ -325,7 +748,7 @@ DifficultyRating Calc::CalcMain(const vector<NoteInfo>& NoteInfo, float music_ra
 
     float highest = max(difficulty.overall, highest_difficulty(difficulty));
 
-    difficulty.overall = AggregateScores(skillset_vector(difficulty), 0.f, 10.24f);
+    difficulty.overall = AggregateScores(skillsets(difficulty), 0.f, 10.24f, options, evaluations.aggregate);
 
     if (downscale_chordjack_at_end) {
         difficulty.chordjack *= 0.9f;
@@ -356,35 +779,64 @@ DifficultyRating Calc::CalcMain(const vector<NoteInfo>& NoteInfo, float music_ra
     return difficulty;
 }
 
-// ugly jack stuff
+vector<DifficultyRating> Calc::CalcGoals(const PreparedChart& chart, float music_rate,
+                                         const vector<float>& score_goals) {
+#ifdef MINACALC_STATS
+    stats = CalcStats();
+    stats.calculations = score_goals.size();
+#endif
+    CALC_STATS_TIMER(CalcStats::CALC_MAIN);
+    vector<DifficultyRating> ratings(score_goals.size(), DifficultyRating {0, 0, 0, 0, 0, 0, 0, 0});
+    if (score_goals.empty())
+        return ratings;
+    {
+        ObservedPhase phase(options.observer, INIT_PHASE);
+        Init(chart, music_rate);
+    }
+
+    sweeping = true;
+    SearchStats sweep_evaluations;
+    for (size_t i = 0; i < score_goals.size(); i++) {
+        ratings[i] = CalcRatings(chart, score_goals[i]);
+        sweep_evaluations.Add(evaluations);
+    }
+    evaluations = sweep_evaluations;
+
+    sweeping = false;
+    for (auto& scores : remembered_scores)
+        scores.clear();
+    return ratings;
+}
+
+// ugly jack stuff, see calckernels.cpp
 float Calc::JackLoss(const JackSeq& jackseq, float skill) {
-    const float base_ceiling = 1.15f; // Jack multiplier max
-    const float fscale = 1750.f; // How fast ceiling rises
-    const float prop = 0.75f; // Proportion of player difficulty at which jack tax begins
-    const float mag = 250.f; // Jack diff multiplier
-    float output = 0.f;
-    float ceiling = 1.f;
-    float mod = 1.f;
-    
-    for (float jd : jackseq) { // Iterate interval's jack difficulties
-        // Decrease if jack difficulty is over 133% of player skill
-        mod += ((jd/(prop*skill)) - 1) / mag;
-        
-        if (mod > 1.f) {
-            ceiling += (mod - 1) / fscale;
-        }
-        
-        mod = CalcClamp(mod, 1.f, base_ceiling * sqrt(ceiling));
-        
-        jd *= mod;
-        
-        if (skill < jd) { // If player skill below jack diffiulty
-            // This can cause output to decrease if 0.96 * i < x < i
-            output += 1.f - pow(skill / (jd * 0.96f), 1.5f);
-        }
+    return ::JackLoss(skill, jackseq.data(), jackseq.size());
+}
+
+void Calc::InterleaveJacks() {
+    size_t rows = 0;
+    for (int t = 0; t < 4; t++) {
+        jack_lengths[t] = jacks[t].size();
+        rows = max(rows, jack_lengths[t]);
     }
-    
-    return CalcClamp(7.f * output, 0.f, 10000.f);
+    jack_lanes.assign(4 * rows, 0.f);
+    for (int t = 0; t < 4; t++)
+        for (size_t k = 0; k < jack_lengths[t]; k++)
+            jack_lanes[4 * k + t] = jacks[t][k];
+}
+
+void Calc::InterleaveJacks(const std::array<size_t, 4>& first) {
+    // Every column fits in the new rows, so shrinking only drops padding
+    // and growing only pads
+    size_t rows = 0;
+    for (int t = 0; t < 4; t++) {
+        jack_lengths[t] = jacks[t].size();
+        rows = max(rows, jack_lengths[t]);
+    }
+    jack_lanes.resize(4 * rows, 0.f);
+    for (int t = 0; t < 4; t++)
+        for (size_t k = first[t]; k < jack_lengths[t]; k++)
+            jack_lanes[4 * k + t] = jacks[t][k];
 }
 
 // Go through every note and determine a local jack speed difficulty at
@@ -393,81 +845,115 @@ float Calc::JackLoss(const JackSeq& jackseq, float skill) {
 //  2) (maybe bump that if the recent jack was really fast, i.e. minijack)
 //  3) calculating 2800ms/interval_avg,
 //  4) and maxing that out at the equivalent of 56 local NPS
-// Returns a vector of each local jack speed difficulty
-JackSeq Calc::SequenceJack(const vector<NoteInfo>& NoteInfo, unsigned int t, float music_rate) {
-    vector<float> output;
-    float last = -5.f;
-    
-    // Three most recent note intervals in ms. interval3 is the most
-    // recent one.
-    float interval1;
-    float interval2 = 0.f;
-    float interval3 = 0.f;
-    
-    unsigned int column = 1u << t;
-
-    for (auto row : NoteInfo) {
-        if (row.notes & column) {
-            float scaledtime = row.rowTime / music_rate;
-            interval1 = interval2;
-            interval2 = interval3;
-            interval3 = 1000.f * (scaledtime - last);
-            last = scaledtime;
-            
-            // Take the average of last three note intervals
-            float interval_avg = (interval1 + interval2 + interval3) / 3.f;
-            
-            // If the last interval was really fast, use that instead of
-            // the average
-            interval_avg = min(interval_avg, interval3 * 1.4f);
-            
-            // Difficulty for the 'local' jack speed
-            // For example 1 NPS => 2.8; 2 NPS => 5.6; 10 NPS => 28
-            float local_nps = 1000.f / interval_avg;
-            float jack_difficulty = 2.8f * local_nps;
-            
-            // Max out local jack speed difficulty at an equivalent of 
-            // ~17.857 NPS (remember, this is just one finger)
-            jack_difficulty = min(jack_difficulty, 50.f);
-            
-            output.push_back(jack_difficulty);
-        }
-    }
-    return output;
+// Before a column's third note, the missing intervals count as 0.
+float Calc::JackDifficulty(float interval1, float interval2, float interval3) {
+    // Take the average of last three note intervals
+    float interval_avg = (interval1 + interval2 + interval3) / 3.f;
+    
+    // If the last interval was really fast, use that instead of
+    // the average
+    interval_avg = min(interval_avg, interval3 * 1.4f);
+    
+    // Difficulty for the 'local' jack speed
+    // For example 1 NPS => 2.8; 2 NPS => 5.6; 10 NPS => 28
+    float local_nps = 1000.f / interval_avg;
+    float jack_difficulty = 2.8f * local_nps;
+    
+    // Max out local jack speed difficulty at an equivalent of 
+    // ~17.857 NPS (remember, this is just one finger)
+    return min(jack_difficulty, 50.f);
 }
 
-Finger Calc::ProcessFinger(const vector<NoteInfo>& NoteInfo, unsigned int t, float music_rate) {
-    int interval_i = 0;
-    float last = -5.f;
-    Finger all_intervals(numitv, vector<float>());
-    unsigned int column = 1u << t;
+void Calc::ProcessRows(const PreparedChart& chart, float music_rate) {
+    CALC_STATS_TIMER(CalcStats::PROCESS_ROWS);
+    itv_counts.assign(numitv, IntervalCounts());
+    for (size_t t = 0; t < fingers.size(); t++) {
+        fingers[t].Reset(numitv);
+        fingers[t].values.reserve(chart.column_taps[t]);
+        jacks[t].clear();
+        jacks[t].reserve(chart.column_taps[t]);
+    }
 
-    for (size_t i = 0; i < NoteInfo.size(); i++) {
-        float scaledtime = NoteInfo[i].rowTime / music_rate;
+    // Time of the last note in each column
+    float last[4] = {-5.f, -5.f, -5.f, -5.f};
+    // The two note intervals before the last one in each column
+    float jack_intervals[4][2] = {};
+    
+    int interval_i = 0;
+    for (size_t row = 0; row < chart.row_times.size(); row++) {
+        float scaledtime = chart.row_times[row] / music_rate;
 
-        while (scaledtime > static_cast<float>(interval_i + 1) * IntervalSpan)
+        while (scaledtime > static_cast<float>(interval_i + 1) * IntervalSpan && interval_i + 1 < numitv)
             ++interval_i;
 
-        if (NoteInfo[i].notes & column) {
-            float interval_ms = 1000 * (scaledtime - last);
-            all_intervals[interval_i].push_back(CalcClamp(interval_ms, 40.f, 5000.f));
-            last = scaledtime;
+        unsigned int notes = chart.row_notes[row];
+        itv_counts[interval_i].AddRow(notes, chart.row_taps[row]);
+
+        for (unsigned int t = 0; t < 4; t++) {
+            if (!(notes & (1u << t)))
+                continue;
+
+            float interval_ms = 1000 * (scaledtime - last[t]);
+            fingers[t].Append(interval_i, FingerValue(interval_ms));
+            float* recent = jack_intervals[t];
+            jacks[t].push_back(JackDifficulty(recent[0], recent[1], interval_ms));
+            recent[0] = recent[1];
+            recent[1] = interval_ms;
+            last[t] = scaledtime;
         }
     }
-    
-    return all_intervals;
+    for (Finger& finger : fingers)
+        finger.Finish();
+    InterleaveJacks();
+}
+
+int Calc::IntervalOf(float scaled_time) const {
+    // Same as ProcessRows' walk: the first interval that doesn't end
+    // before the row, or the last one
+    int interval_i = 0;
+    if (scaled_time > 0.f) {
+        float estimate = scaled_time / IntervalSpan;
+        interval_i = estimate < static_cast<float>(numitv) ? static_cast<int>(estimate) : numitv - 1;
+    }
+    while (interval_i > 0 && !(scaled_time > static_cast<float>(interval_i) * IntervalSpan))
+        --interval_i;
+    while (scaled_time > static_cast<float>(interval_i + 1) * IntervalSpan && interval_i + 1 < numitv)
+        ++interval_i;
+    return interval_i;
+}
+
+float Calc::FingerValue(float interval_ms) {
+    return CalcClamp(interval_ms, 40.f, 5000.f);
+}
+
+// Index of the chisel scoring `type` with or without stamina, see
+// STAMINA_CHISEL
+int chisel_slot(ChiselType type, bool stam) {
+    return stam ? STAMINA_CHISEL : type;
 }
 
 float Calc::CalcScoreForPlayerSkill(float player_skill, ChiselType type, bool stam) {
+    // The chisels can run concurrently, so each only writes counters no
+    // other one does: its own score_calls slot, jack_loss_calls for the
+    // JACK chisel and stam_adjust_calls for the stamina one
+    CALC_STATS_COUNT(score_calls[chisel_slot(type, stam)], 1);
+    if (type == JACK)
+        CALC_STATS_COUNT(jack_loss_calls, 4);
+    if (stam)
+        CALC_STATS_COUNT(stam_adjust_calls, left_hand.v_itvpoints.size() + right_hand.v_itvpoints.size());
+    if (checkpoints && (type == JACK || left_hand.Resumable(player_skill, stam)))
+        return ResumedScore(player_skill, type, stam);
     float achieved_points;
     if (type == JACK) {
         // Max achievable points, minus the points the player's losing
         // from jack patterns
+        float losses[4];
+        JackLosses(player_skill, jack_lanes.data(), jack_lengths.data(), losses);
         achieved_points = MaxPoints
-                - JackLoss(j0, player_skill)
-                - JackLoss(j1, player_skill)
-                - JackLoss(j2, player_skill)
-                - JackLoss(j3, player_skill);
+                - losses[0]
+                - losses[1]
+                - losses[2]
+                - losses[3];
     } else {
         // Expected achieved points by left and right hand summed up
         achieved_points = left_hand.CalcInternal(player_skill, type, stam);
@@ -477,25 +963,160 @@ float Calc::CalcScoreForPlayerSkill(float player_skill, ChiselType type, bool st
     return achieved_points / MaxPoints;
 }
 
+void Calc::CalcScoresForPlayerSkills(const float* skills, size_t count, ChiselType type, bool stam,
+                                     float* scores) {
+    // ResumedScore has nothing to share between the skills either
+    if (type == JACK || checkpoints) {
+        for (size_t k = 0; k < count; k++)
+            scores[k] = CalcScoreForPlayerSkill(skills[k], type, stam);
+        return;
+    }
+    // See CalcScoreForPlayerSkill
+    CALC_STATS_COUNT(score_calls[chisel_slot(type, stam)], count);
+    if (stam)
+        CALC_STATS_COUNT(stam_adjust_calls, count * (left_hand.v_itvpoints.size() + right_hand.v_itvpoints.size()));
+    float left_points[MAX_PROBES];
+    float right_points[MAX_PROBES];
+    left_hand.CalcInternals(skills, count, type, stam, left_points);
+    right_hand.CalcInternals(skills, count, type, stam, right_points);
+    for (size_t k = 0; k < count; k++) {
+        // In CalcScoreForPlayerSkill's order
+        float achieved_points = left_points[k];
+        achieved_points += right_points[k];
+        scores[k] = achieved_points / MaxPoints;
+    }
+}
+
+// Key of a score in Calc::remembered_scores
+uint64_t remembered_key(float player_skill, ChiselType type) {
+    uint32_t skill_bits;
+    std::memcpy(&skill_bits, &player_skill, sizeof skill_bits);
+    return static_cast<uint64_t>(type) << 32 | skill_bits;
+}
+
+float Calc::RememberedScore(float player_skill, ChiselType type, bool stam) {
+    // Concurrent chisels each have their own map
+    auto& scores = remembered_scores[chisel_slot(type, stam)];
+    uint64_t key = remembered_key(player_skill, type);
+    auto found = scores.find(key);
+    if (found != scores.end())
+        return found->second;
+    float score = CalcScoreForPlayerSkill(player_skill, type, stam);
+    scores.emplace(key, score);
+    return score;
+}
+
+void Calc::RememberedScores(const float* skills, size_t count, ChiselType type, bool stam, float* scores) {
+    auto& remembered = remembered_scores[chisel_slot(type, stam)];
+    // The skills that weren't there, scored together
+    float missing[MAX_PROBES];
+    size_t missing_at[MAX_PROBES];
+    size_t missing_count = 0;
+    for (size_t k = 0; k < count; k++) {
+        auto found = remembered.find(remembered_key(skills[k], type));
+        if (found != remembered.end()) {
+            scores[k] = found->second;
+        } else {
+            missing[missing_count] = skills[k];
+            missing_at[missing_count++] = k;
+        }
+    }
+    if (missing_count == 0)
+        return;
+    float computed[MAX_PROBES];
+    CalcScoresForPlayerSkills(missing, missing_count, type, stam, computed);
+    for (size_t j = 0; j < missing_count; j++) {
+        scores[missing_at[j]] = computed[j];
+        remembered.emplace(remembered_key(missing[j], type), computed[j]);
+    }
+}
+
+namespace {
+
+// Hand::ResumeInternal for a column's JackLoss
+float resumed_jack_loss(float skill, const JackSeq& jacks, size_t span, size_t valid, vector<JackWalk>& walks) {
+    if (walks.empty())
+        walks.emplace_back();
+    walks.resize(min(walks.size(), valid / span + 1));
+    JackWalk walk = walks.back();
+    for (size_t start = span * (walks.size() - 1); start < jacks.size(); start += span) {
+        size_t length = min(span, jacks.size() - start);
+        JackWalkOn(skill, jacks.data() + start, length, 1, walk);
+        if (length == span)
+            walks.push_back(walk);
+    }
+    return JackWalkLoss(walk);
+}
+
+} // namespace
+
+float Calc::ResumedScore(float player_skill, ChiselType type, bool stam) {
+    // Concurrent chisels each have their own map, as in RememberedScore
+    ScoreCheckpoints::Score& score =
+            checkpoints->scores[chisel_slot(type, stam)][remembered_key(player_skill, type)];
+    if (score.generation == checkpoints->generation)
+        return score.score;
+    // Else it's new, or from the last Rate(), which dropped the older ones
+    score.generation = checkpoints->generation;
+    float achieved_points;
+    if (type == JACK) {
+        // As in CalcScoreForPlayerSkill, JackLosses being JackLoss's
+        float losses[4];
+        for (int c = 0; c < 4; c++)
+            losses[c] = resumed_jack_loss(player_skill, jacks[c], ScoreCheckpoints::NoteSpan,
+                                          checkpoints->valid_notes[c], score.columns[c]);
+        achieved_points = MaxPoints
+                - losses[0]
+                - losses[1]
+                - losses[2]
+                - losses[3];
+    } else {
+        size_t valid = checkpoints->valid_intervals;
+        achieved_points = left_hand.ResumeInternal(player_skill, type, stam, ScoreCheckpoints::IntervalSpan, valid,
+                                                   score.hands[0]);
+        achieved_points += right_hand.ResumeInternal(player_skill, type, stam, ScoreCheckpoints::IntervalSpan, valid,
+                                                     score.hands[1]);
+    }
+    score.score = achieved_points / MaxPoints;
+    return score.score;
+}
+
 // Approximate player skill required to achieve `score_goal`. The
 // approximation can be influenced via the `flags`.
 float Calc::Chisel(float player_skill, float resolution, float score_goal, ChiselType type, bool stam) {
-    auto check_if_too_low = [this, score_goal, type, stam](float player_skill) {
-        float score = CalcScoreForPlayerSkill(player_skill, type, stam);
-        return score < score_goal;
+    CALC_STATS_TIMER(stam ? CalcStats::CHISEL_STAMINA : CalcStats::CHISEL_STREAM + type);
+    auto residual = [this, score_goal, type, stam](float player_skill) {
+        float score = sweeping ? RememberedScore(player_skill, type, stam)
+                               : CalcScoreForPlayerSkill(player_skill, type, stam);
+        return score - score_goal;
     };
-    return approximate(player_skill, resolution, 7, check_if_too_low, true);
+    // Every Chisel call in CalcMain has its own counter, so concurrent
+    // chisels don't share one
+    int& chisel_evaluations = evaluations.chisel[chisel_slot(type, stam)];
+    // The JACK chisel has no pass to share, see CalcScoresForPlayerSkills
+    if (options.probes > 1 && type != JACK) {
+        auto residuals = [this, score_goal, type, stam](const float* skills, size_t count, float* residuals) {
+            if (sweeping)
+                RememberedScores(skills, count, type, stam, residuals);
+            else
+                CalcScoresForPlayerSkills(skills, count, type, stam, residuals);
+            for (size_t k = 0; k < count; k++)
+                residuals[k] -= score_goal;
+        };
+        return approximate_probes(player_skill, resolution, 7, residuals, options, chisel_evaluations, true);
+    }
+    return approximate(player_skill, resolution, 7, residual, options, chisel_evaluations, true);
 }
 
 // Looks at 6 smallest note intervals and returns 1375 / avg_interval_ms
 // which could also be expressed as 1.375 * avg_intervals_per_second.
-float Hand::CalcMSEstimate(vector<float>& input) {
+float Hand::CalcMSEstimate(IntervalRange<float> input) {
     if (input.empty())
         return 0.f;
 
     // Sort list to be able to take the first six elements as the
     // smallest note intervals
-    sort(input.begin(), input.end());
+    std::sort(input.begin(), input.end());
     input[0] *= 1.066f; //This is gross
     size_t length = min(input.size(), static_cast<size_t>(6));
     
@@ -508,20 +1129,23 @@ float Hand::CalcMSEstimate(vector<float>& input) {
     return 1375.f / avg_interval_ms;
 }
 
+void Hand::IntervalDiff(IntervalRange<float> f1, IntervalRange<float> f2, float& nps_out, float& ms_out) const {
+    float nps_diff = 1.6f * static_cast<float>(f1.size() + f2.size());
+    
+    float left_ms_diff = CalcMSEstimate(f1);
+    float right_ms_diff = CalcMSEstimate(f2);
+    float ms_diff = max(left_ms_diff, right_ms_diff);
+    
+    nps_out = basescaler * nps_diff;
+    ms_out = basescaler * (5.f * ms_diff + 4.f * nps_diff) / 9.f;
+}
+
 void Hand::InitDiff(Finger& f1, Finger& f2) {
-    v_itvNPSdiff = vector<float>(f1.size());
-    v_itvMSdiff = vector<float>(f1.size());
+    v_itvNPSdiff.assign(f1.size(), 0.f);
+    v_itvMSdiff.assign(f1.size(), 0.f);
 
-    for (size_t i = 0; i < f1.size(); i++) {
-        float nps_diff = 1.6f * static_cast<float>(f1[i].size() + f2[i].size());
-        
-        float left_ms_diff = CalcMSEstimate(f1[i]);
-        float right_ms_diff = CalcMSEstimate(f2[i]);
-        float ms_diff = max(left_ms_diff, right_ms_diff);
-        
-        v_itvNPSdiff[i] = basescaler * nps_diff;
-        v_itvMSdiff[i] = basescaler * (5.f * ms_diff + 4.f * nps_diff) / 9.f;
-    }
+    for (size_t i = 0; i < f1.size(); i++)
+        IntervalDiff(f1[i], f2[i], v_itvNPSdiff[i], v_itvMSdiff[i]);
     Smooth(v_itvNPSdiff, 0.f);
     if (SmoothDifficulty)
         DifficultyMSSmooth(v_itvMSdiff);
@@ -530,74 +1154,120 @@ void Hand::InitDiff(Finger& f1, Finger& f2) {
 // Fills in the v_itvpoints vector which holds the max number of points
 // for each interval
 void Hand::InitPoints(const Finger& f1, const Finger& f2) {
+    v_itvpoints.clear();
     for (size_t i = 0; i < f1.size(); i++) {
         size_t max_interval_points = f1[i].size() + f2[i].size();
         v_itvpoints.push_back(static_cast<int>(max_interval_points));
     }
 }
 
-void Hand::StamAdjust(float skill, vector<float>& diff) {
-    float floor = 1.f; // stamina multiplier min (increases as chart advances)
-    float multiplier = 1.f;
-    float last_diff = 0.f;
+void Hand::InitChiselDiffs() {
+    size_t n = v_itvpoints.size();
+    v_chiseldiff.resize(NUM_HAND_CHISELTYPES * n);
+    UpdateChiselDiffs(0, n);
+}
 
-    for (float& i : diff) {
-        // Move-average the diffs with n=2
-        float diff_avg = (last_diff + i) / 2;
-        last_diff = i;
-        
-        // Higher number -> harder to sustain this difficulty for player
-        float tax = diff_avg / (prop * skill);
-        multiplier += (tax - 1) / mag;
-        
-        // If this section is particularly difficult, deplete stamina
-        // a bit by raising the multiplier floor
-        if (multiplier > 1.f)
-            floor += (multiplier - 1) / fscale;
-        
-        // Cap and apply multiplier
-        multiplier = CalcClamp(multiplier, floor, ceil);
-        i *= multiplier;
+void Hand::UpdateChiselDiffs(size_t first, size_t last) {
+    size_t n = v_itvpoints.size();
+    for (int t = 0; t < NUM_HAND_CHISELTYPES; t++) {
+        auto type = static_cast<ChiselType>(t);
+        const vector<float>& base = (type == TECH) ? v_itvMSdiff : v_itvNPSdiff;
+        float* diff = &v_chiseldiff[t * n];
+
+        for (size_t i = first; i < last; ++i) {
+            diff[i] = base[i];
+            diff[i] *= anchorscale[i] * rollscale[i];
+            
+            if (type == STREAM) {
+                diff[i] *= hsscale[i] * hsscale[i] * hsscale[i] * ohjumpscale[i] * ohjumpscale[i] * jumpscale[i] * jumpscale[i];
+            } else if (type == JS) {
+                diff[i] *= sqrt(ohjumpscale[i]) * hsscale[i] * hsscale[i] * jumpscale[i];
+            } else if (type == HS) {
+                diff[i] *= sqrt(ohjumpscale[i]) * jumpscale[i];
+            } else if (type == TECH) {
+                diff[i] *= sqrt(ohjumpscale[i]);
+            }
+        }
     }
 }
 
+void Hand::InitSortedPoints() {
+    if (!sorted_points)
+        return;
+    for (int t = 0; t < NUM_HAND_CHISELTYPES; t++)
+        sorted_diffs[t].Assign(ChiselDiff(static_cast<ChiselType>(t)), v_itvpoints.data(), v_itvpoints.size());
+}
+
+float Hand::StamAdjust(float skill, float diff, StamState& state) const {
+    // Move-average the diffs with n=2
+    float diff_avg = (state.last_diff + diff) / 2;
+    state.last_diff = diff;
+    
+    // Higher number -> harder to sustain this difficulty for player
+    float tax = diff_avg / (prop * skill);
+    state.multiplier += (tax - 1) / mag;
+    
+    // If this section is particularly difficult, deplete stamina
+    // a bit by raising the multiplier floor
+    if (state.multiplier > 1.f)
+        state.floor += (state.multiplier - 1) / fscale;
+    
+    // Cap and apply multiplier
+    state.multiplier = CalcClamp(state.multiplier, state.floor, ceil);
+    return diff * state.multiplier;
+}
+
 // Calculates the number of points a player with `player_skill` will be
 // expected to achieve. The calculation can be influenced through the
 // `flags`
-float Hand::CalcInternal(float player_skill, ChiselType type, bool stam) {
-    vector<float> diff = (type == TECH) ? v_itvMSdiff : v_itvNPSdiff;
+float Hand::CalcInternal(float player_skill, ChiselType type, bool stam) const {
+    const float* diff = ChiselDiff(type);
+    const int* points = v_itvpoints.data();
+    size_t n = v_itvpoints.size();
     
-    for (size_t i = 0; i < diff.size(); ++i) {
-        diff[i] *= anchorscale[i] * rollscale[i];
-        
-        if (type == STREAM) {
-            diff[i] *= hsscale[i] * hsscale[i] * hsscale[i] * ohjumpscale[i] * ohjumpscale[i] * jumpscale[i] * jumpscale[i];
-        } else if (type == JS) {
-            diff[i] *= sqrt(ohjumpscale[i]) * hsscale[i] * hsscale[i] * jumpscale[i];
-        } else if (type == HS) {
-            diff[i] *= sqrt(ohjumpscale[i]) * jumpscale[i];
-        } else if (type == TECH) {
-            diff[i] *= sqrt(ohjumpscale[i]);
-        }
-    }
+    // Each interval's difficulty is final at this point, except for the
+    // stamina adjustment, which only depends on the intervals before it
+    // and so is applied on the fly. Now, we are going to calculate the
+    // number of expected achieved points out of those difficulties.
     
-    if (stam)
-        StamAdjust(player_skill, diff);
+    if (!stam && sorted_points && player_skill > 0.f)
+        return sorted_diffs[type].ExpectedPoints(player_skill);
+    if (!stam)
+        return fast_points ? ExpectedPointsFast(player_skill, diff, points, n)
+                           : ExpectedPoints(player_skill, diff, points, n);
     
-    // Until now, that was the setup code, where we calculated each
-    // individual interval's difficulty. Now, we are going to calculate
-    // the number of expected achieved points out of those difficulties.
+    if (fast_points) {
+        // Stamina adjust a block serially, then let the kernel have it
+        float adjusted[StamBlock];
+        StamState stam_state;
+        float total_achieved_points = 0.f;
+        for (size_t start = 0; start < n; start += StamBlock) {
+            size_t length = min(StamBlock, n - start);
+            for (size_t i = 0; i < length; i++)
+                adjusted[i] = StamAdjust(player_skill, diff[start + i], stam_state);
+            total_achieved_points += ExpectedPointsFast(player_skill, adjusted, points + start, length);
+        }
+        return total_achieved_points;
+    }
     
-    float total_achieved_points = 0.f;
-    for (size_t i = 0; i < diff.size(); i++) {
+    StamState stam_state;
+    return StamPoints(player_skill, diff, points, 0, n, stam_state, 0.f);
+}
+
+float Hand::StamPoints(float player_skill, const float* diff, const int* points, size_t first, size_t last,
+                       StamState& stam_state, float total) const {
+    float total_achieved_points = total;
+    for (size_t i = first; i < last; i++) {
+        float interval_diff = StamAdjust(player_skill, diff[i], stam_state);
+        
         // Start with the assumption that the player will achieve the
         // max number of points
-        float achieved_points = v_itvpoints[i];
+        float achieved_points = points[i];
         
         // If player skill below required skill for this interval
-        if (player_skill <= diff[i]) {
+        if (player_skill <= interval_diff) {
             // Decrease the number of points the player will achieve
-            achieved_points *= pow(player_skill / diff[i], 1.8f);
+            achieved_points *= pow(player_skill / interval_diff, 1.8f);
         }
         
         total_achieved_points += achieved_points;
@@ -605,34 +1275,113 @@ float Hand::CalcInternal(float player_skill, ChiselType type, bool stam) {
     return total_achieved_points;
 }
 
-vector<float> Calc::OHJumpDownscaler(const vector<NoteInfo>& NoteInfo, unsigned int firstNote, unsigned int secondNote) {
-    vector<float> output;
+float Hand::ResumeInternal(float x, ChiselType type, bool stam, size_t span, size_t valid,
+                           vector<Checkpoint>& checkpoints) const {
+    const float* diff = ChiselDiff(type);
+    const int* points = v_itvpoints.data();
+    size_t n = v_itvpoints.size();
+
+    if (checkpoints.empty())
+        checkpoints.emplace_back();
+    checkpoints.resize(min(checkpoints.size(), valid / span + 1));
+    Checkpoint state = checkpoints.back();
+    for (size_t start = span * (checkpoints.size() - 1); start < n; start += span) {
+        size_t end = min(start + span, n);
+        if (stam)
+            state.total = StamPoints(x, diff, points, start, end, state.stam, state.total);
+        else
+            state.total = ExpectedPoints(x, diff + start, points + start, end - start, state.total);
+        if (end - start == span)
+            checkpoints.push_back(state);
+    }
+    return state.total;
+}
 
-    for (const vector<int>& interval : nervIntervals) {
-        int taps = 0;
-        int jumps = 0;
-        for (int row : interval) {
-            int columns = 0;
-            if (NoteInfo[row].notes & firstNote) {
-                ++columns;
-            }
-            if (NoteInfo[row].notes & secondNote) {
-                ++columns;
-            }
-            if (columns == 2) {
-                jumps++;
-                taps += 2; // this gets added twice intentionally to mimic mina's ratings more closely
-            }
-            taps += columns;
-        }
-        if (taps == 0) {
-            output.push_back(1);
+void Hand::CalcInternals(const float* skills, size_t count, ChiselType type, bool stam, float* points_out) const {
+    const float* diff = ChiselDiff(type);
+    const int* points = v_itvpoints.data();
+    size_t n = v_itvpoints.size();
+
+    if (!stam) {
+        if (sorted_points || fast_points) {
+            // Nothing to share between the skills there
+            for (size_t k = 0; k < count; k++)
+                points_out[k] = CalcInternal(skills[k], type, stam);
         } else {
-            // This can be max 1/4
-            float jump_proportion = static_cast<float>(jumps) / static_cast<float>(taps);
-            // Therefore this'll be max ~0.880
-            output.push_back(pow(1 - (1.6f * jump_proportion), 0.25f));
+            ExpectedPointsMulti(skills, count, diff, points, n, points_out);
+        }
+        return;
+    }
+
+    // Each skill's stamina state still goes through the intervals in
+    // order, as in CalcInternal, but the skills' serial StamAdjust chains
+    // are interleaved
+    StamState stam_states[MAX_PROBES];
+    float totals[MAX_PROBES] = {};
+    if (fast_points) {
+        float adjusted[MAX_PROBES][StamBlock];
+        for (size_t start = 0; start < n; start += StamBlock) {
+            size_t length = min(StamBlock, n - start);
+            for (size_t i = 0; i < length; i++)
+                for (size_t k = 0; k < count; k++)
+                    adjusted[k][i] = StamAdjust(skills[k], diff[start + i], stam_states[k]);
+            for (size_t k = 0; k < count; k++)
+                totals[k] += ExpectedPointsFast(skills[k], adjusted[k], points + start, length);
+        }
+    } else {
+        for (size_t i = 0; i < n; i++) {
+            for (size_t k = 0; k < count; k++) {
+                float interval_diff = StamAdjust(skills[k], diff[i], stam_states[k]);
+                float achieved_points = points[i];
+                if (skills[k] <= interval_diff)
+                    achieved_points *= pow(skills[k] / interval_diff, 1.8f);
+                totals[k] += achieved_points;
+            }
         }
+    }
+    for (size_t k = 0; k < count; k++)
+        points_out[k] = totals[k];
+}
+
+template <typename T>
+size_t capacity_bytes(const vector<T>& v) {
+    return v.capacity() * sizeof(T);
+}
+
+size_t hand_bytes(const Hand& hand) {
+    return capacity_bytes(hand.ohjumpscale) + capacity_bytes(hand.rollscale) + capacity_bytes(hand.hsscale) +
+           capacity_bytes(hand.jumpscale) + capacity_bytes(hand.anchorscale) + capacity_bytes(hand.v_itvpoints) +
+           capacity_bytes(hand.v_itvNPSdiff) + capacity_bytes(hand.v_itvMSdiff) + capacity_bytes(hand.v_chiseldiff);
+}
+
+size_t Calc::ReservedBytes() const {
+    size_t bytes = capacity_bytes(itv_counts) + hand_bytes(left_hand) + hand_bytes(right_hand);
+    for (const Finger& finger : fingers)
+        bytes += capacity_bytes(finger.values) + capacity_bytes(finger.offsets);
+    for (const JackSeq& jack : jacks)
+        bytes += capacity_bytes(jack);
+    return bytes + capacity_bytes(jack_lanes);
+}
+
+float Calc::OHJumpScale(const IntervalCounts& counts, int hand) {
+    int jumps = counts.ohjumps[hand];
+    // Jumps get their taps added twice intentionally to mimic mina's
+    // ratings more closely
+    int taps = counts.column_taps[2 * hand] + counts.column_taps[2 * hand + 1] + 2 * jumps;
+    if (taps == 0)
+        return 1;
+    // This can be max 1/4
+    float jump_proportion = static_cast<float>(jumps) / static_cast<float>(taps);
+    // Therefore this'll be max ~0.880
+    return pow(1 - (1.6f * jump_proportion), 0.25f);
+}
+
+void Calc::OHJumpDownscaler(int hand, vector<float>& output) {
+    CALC_STATS_TIMER(CalcStats::OHJUMP_SCALER);
+    output.clear();
+
+    for (const IntervalCounts& counts : itv_counts) {
+        output.push_back(OHJumpScale(counts, hand));
 
         if (logpatterns)
             std::cout << "ohj " << output.back() << std::endl;
@@ -640,21 +1389,15 @@ vector<float> Calc::OHJumpDownscaler(const vector<NoteInfo>& NoteInfo, unsigned
 
     if (SmoothPatterns)
         Smooth(output, 1.f);
-    return output;
 }
 
-float Calc::CalculateFingerbias(const vector<NoteInfo>& NoteInfo, unsigned int finger1, unsigned int finger2) {
+float Calc::CalculateFingerbias(int f1, int f2) {
+    CALC_STATS_TIMER(CalcStats::FINGERBIAS);
     float fingerbias = 0;
     
-    for (size_t i = 0; i < nervIntervals.size(); i++) {
-        int lcol = 0;
-        int rcol = 0;
-        for (int row : nervIntervals[i]) {
-            if (NoteInfo[row].notes & finger1)
-                ++lcol;
-            if (NoteInfo[row].notes & finger2)
-                ++rcol;
-        }
+    for (const IntervalCounts& counts : itv_counts) {
+        int lcol = counts.column_taps[f1];
+        int rcol = counts.column_taps[f2];
         
         float smaller_col = static_cast<float>(min(lcol, rcol));
         float larger_col = static_cast<float>(max(lcol, rcol));
@@ -665,31 +1408,27 @@ float Calc::CalculateFingerbias(const vector<NoteInfo>& NoteInfo, unsigned int f
     return fingerbias;
 }
 
-vector<float> Calc::Anchorscaler(const vector<NoteInfo>& NoteInfo, unsigned int firstNote, unsigned int secondNote) {
-    vector<float> output(nervIntervals.size());
+float Calc::AnchorScale(const IntervalCounts& counts, int f1, int f2) {
+    int lcol = counts.column_taps[f1];
+    int rcol = counts.column_taps[f2];
+    if (lcol == 0 || rcol == 0)
+        return 1.f;
+    
+    float smaller_col = static_cast<float>(min(lcol, rcol));
+    float larger_col = static_cast<float>(max(lcol, rcol));
+    
+    // Can range from ~0.881 (when the cols have exactly the
+    // same number of notes) to approaching 1 when one column
+    // has way more notes than the other.
+    return CalcClamp(sqrt(1 - (smaller_col / larger_col / 4.45f)), 0.8f, 1.05f);
+}
 
-    for (size_t i = 0; i < nervIntervals.size(); i++) {
-        int lcol = 0;
-        int rcol = 0;
-        for (int row : nervIntervals[i]) {
-            if (NoteInfo[row].notes & firstNote)
-                ++lcol;
-            if (NoteInfo[row].notes & secondNote)
-                ++rcol;
-        }
-        bool anyzero = lcol == 0 || rcol == 0;
-        
-        float smaller_col = static_cast<float>(min(lcol, rcol));
-        float larger_col = static_cast<float>(max(lcol, rcol));
-        
-        if (anyzero) {
-            output[i] = 1.f;
-        } else {
-            // Can range from ~0.881 (when the cols have exactly the
-            // same number of notes) to approaching 1 when one column
-            // has way more notes than the other.
-            output[i] = CalcClamp(sqrt(1 - (smaller_col / larger_col / 4.45f)), 0.8f, 1.05f);
-        }
+void Calc::Anchorscaler(int f1, int f2, vector<float>& output) {
+    CALC_STATS_TIMER(CalcStats::ANCHOR_SCALER);
+    output.resize(itv_counts.size());
+
+    for (size_t i = 0; i < itv_counts.size(); i++) {
+        output[i] = AnchorScale(itv_counts[i], f1, f2);
 
         if (logpatterns)
             std::cout << "an " << output[i] << std::endl;
@@ -697,32 +1436,26 @@ vector<float> Calc::Anchorscaler(const vector<NoteInfo>& NoteInfo, unsigned int
 
     if (SmoothPatterns)
         Smooth(output, 1.f);
-    return output;
 }
 
 // Downscale if there's many hands. Max downscale value is ~0.903 if the
 // chart is 100% hands
-vector<float> Calc::HSDownscaler(const vector<NoteInfo>& NoteInfo) {
-    vector<float> output(nervIntervals.size());
-
-    for (size_t i = 0; i < nervIntervals.size(); i++) {
-        unsigned int taps = 0;
-        unsigned int hands = 0;
-        for (int row : nervIntervals[i]) {
-            unsigned int notes = column_count(NoteInfo[row].notes);
-            taps += notes;
-            if (notes == 3)
-                hands++;
-        }
-        if (taps == 0) {
-            output[i] = 1.f;
-        } else {
-            // Note that this can't ever be over 1/3
-            float hand_proportion = static_cast<float>(hands) / static_cast<float>(taps);
-            // Therefore this downscaling value can't ever be below ~0.903
-            // A 3-1-2-1 pattern would result in ~0.962
-            output[i] = sqrt(sqrt(1 - hand_proportion));
-        }
+float Calc::HSScale(const IntervalCounts& counts) {
+    if (counts.taps == 0)
+        return 1.f;
+    // Note that this can't ever be over 1/3
+    float hand_proportion = static_cast<float>(counts.hands) / static_cast<float>(counts.taps);
+    // Therefore this downscaling value can't ever be below ~0.903
+    // A 3-1-2-1 pattern would result in ~0.962
+    return sqrt(sqrt(1 - hand_proportion));
+}
+
+void Calc::HSDownscaler(vector<float>& output) {
+    CALC_STATS_TIMER(CalcStats::HS_SCALER);
+    output.resize(itv_counts.size());
+
+    for (size_t i = 0; i < itv_counts.size(); i++) {
+        output[i] = HSScale(itv_counts[i]);
 
         if (logpatterns)
             std::cout << "hs " << output[i] << std::endl;
@@ -730,66 +1463,62 @@ vector<float> Calc::HSDownscaler(const vector<NoteInfo>& NoteInfo) {
 
     if (SmoothPatterns)
         Smooth(output, 1.f);
-    return output;
 }
 
 // Downscale if there's many jumps, max downscaling is ~0.955 if the
 // chart is 100% jumps
-vector<float> Calc::JumpDownscaler(const vector<NoteInfo>& NoteInfo) {
-    vector<float> output(nervIntervals.size());
-
-    for (size_t i = 0; i < nervIntervals.size(); i++) {
-        unsigned int taps = 0;
-        unsigned int jumps = 0;
-        for (int row : nervIntervals[i]) {
-            unsigned int notes = column_count(NoteInfo[row].notes);
-            taps += notes;
-            if (notes == 2)
-                jumps++;
-        }
-        if (taps == 0) {
-            output[i] = 1.f;
-        } else {
-            // Note that this can't ever be over 1/2
-            float jump_proportion = static_cast<float>(jumps) / static_cast<float>(taps);
-            // Therefore this downscaling value can't ever be below ~0.955
-            output[i] = sqrt(sqrt(1 - jump_proportion / 3.f));
-        }
+float Calc::JumpScale(const IntervalCounts& counts) {
+    if (counts.taps == 0)
+        return 1.f;
+    // Note that this can't ever be over 1/2
+    float jump_proportion = static_cast<float>(counts.jumps) / static_cast<float>(counts.taps);
+    // Therefore this downscaling value can't ever be below ~0.955
+    return sqrt(sqrt(1 - jump_proportion / 3.f));
+}
+
+void Calc::JumpDownscaler(vector<float>& output) {
+    CALC_STATS_TIMER(CalcStats::JUMP_SCALER);
+    output.resize(itv_counts.size());
+
+    for (size_t i = 0; i < itv_counts.size(); i++) {
+        output[i] = JumpScale(itv_counts[i]);
 
         if (logpatterns)
             std::cout << "ju " << output[i] << std::endl;
     }
     if (SmoothPatterns)
         Smooth(output, 1.f);
-    return output;
 }
 
-vector<float> Calc::RollDownscaler(const Finger& f1, const Finger& f2) {
+float Calc::RollScale(IntervalRange<const float> f1, IntervalRange<const float> f2, vector<float>& hand_intervals) {
+    // If there is none or only one note in this interval, skip
+    if (f1.size() + f2.size() <= 1)
+        return 1.f;
+    hand_intervals.clear();
+    for (float time1 : f1)
+        hand_intervals.push_back(time1);
+    for (float time2 : f2)
+        hand_intervals.push_back(time2);
+
+    float interval_mean = mean(hand_intervals);
+
+    for (float & note : hand_intervals)
+        if (interval_mean / note < 0.6f)
+            note = interval_mean;
+
+    float interval_cv = cv(hand_intervals) + 0.85f;
+    return interval_cv >= 1.0f ? min(sqrt(sqrt(interval_cv)), 1.075f) : interval_cv*interval_cv*interval_cv;
+}
+
+void Calc::RollDownscaler(const Finger& f1, const Finger& f2, vector<float>& output) {
+    CALC_STATS_TIMER(CalcStats::ROLL_SCALER);
     // this is slightly problematic because if one finger is longer than
     // the other you could potentially have different results with f1
     // and f2 switched
-    vector<float> output(f1.size());
+    output.resize(f1.size());
 
     for (size_t i = 0; i < f1.size(); i++) {
-        // If there is none or only one note in this interval, skip
-        if (f1[i].size() + f2[i].size() <= 1) {
-            output[i] = 1.f;
-            continue;
-        }
-        vector<float> hand_intervals;
-        for (float time1 : f1[i])
-            hand_intervals.push_back(time1);
-        for (float time2 : f2[i])
-            hand_intervals.push_back(time2);
-
-        float interval_mean = mean(hand_intervals);
-
-        for (float & note : hand_intervals)
-            if (interval_mean / note < 0.6f)
-                note = interval_mean;
-
-        float interval_cv = cv(hand_intervals) + 0.85f;
-        output[i] = interval_cv >= 1.0f ? min(sqrt(sqrt(interval_cv)), 1.075f) : interval_cv*interval_cv*interval_cv;
+        output[i] = RollScale(f1[i], f2[i], roll_intervals);
 
         if (logpatterns)
             std::cout << "ro " << output[i] << std::endl;
@@ -797,36 +1526,141 @@ vector<float> Calc::RollDownscaler(const Finger& f1, const Finger& f2) {
 
     if (SmoothPatterns)
         Smooth(output, 1.f);
+}
+
+namespace {
+
+// The workspace of the MinaSDCalc overloads that don't take one, and
+// whether a call on this thread is using it
+thread_local CalcWorkspace thread_workspace;
+thread_local bool thread_workspace_used = false;
 
-    return output;
+// Runs rate(workspace) in this thread's workspace, or, in a call made
+// from inside another one (e.g. by a CalcObserver), in a new one
+template <typename Rate>
+DifficultyRating in_thread_workspace(Rate rate) {
+    if (thread_workspace_used) {
+        auto workspace = std::make_unique<CalcWorkspace>();
+        return rate(*workspace);
+    }
+    struct Release {
+        ~Release() { thread_workspace_used = false; }
+    } release;
+    thread_workspace_used = true;
+    return rate(thread_workspace);
 }
 
+} // namespace
+
 // Function to generate SSR rating
 DifficultyRating MinaSDCalc(const vector<NoteInfo>& NoteInfo, float musicrate, float goal) {
+    return MinaSDCalc(NoteInfo, musicrate, goal, CalcOptions());
+}
+
+DifficultyRating MinaSDCalc(const vector<NoteInfo>& NoteInfo, float musicrate, float goal, const CalcOptions& options) {
+    if (NoteInfo.empty()) {
+        return DifficultyRating {0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0};
+    }
+    return in_thread_workspace([&](CalcWorkspace& workspace) {
+        return MinaSDCalc(NoteInfo, musicrate, goal, workspace, options);
+    });
+}
+
+DifficultyRating MinaSDCalc(const PreparedChart& chart, float musicrate, float goal, const CalcOptions& options) {
+    if (chart.empty()) {
+        return DifficultyRating {0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0};
+    }
+    return in_thread_workspace([&](CalcWorkspace& workspace) {
+        return MinaSDCalc(chart, musicrate, goal, workspace, options);
+    });
+}
+
+DifficultyRating MinaSDCalc(const vector<NoteInfo>& NoteInfo, float musicrate, float goal, CalcWorkspace& workspace,
+                            const CalcOptions& options) {
     if (NoteInfo.empty()) {
         return DifficultyRating {0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0};
     }
-    return std::make_unique<Calc>()->CalcMain(NoteInfo, musicrate, goal);
+    workspace.chart.Assign(NoteInfo);
+    return MinaSDCalc(workspace.chart, musicrate, goal, workspace, options);
+}
+
+DifficultyRating MinaSDCalc(const PreparedChart& chart, float musicrate, float goal, CalcWorkspace& workspace,
+                            const CalcOptions& options) {
+    if (chart.empty()) {
+        return DifficultyRating {0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0};
+    }
+    Calc& calc = workspace.calc;
+    calc.options = options;
+    DifficultyRating rating = calc.CalcMain(chart, musicrate, goal);
+    if (options.search_stats)
+        options.search_stats->Add(calc.evaluations);
+#ifdef MINACALC_STATS
+    if (options.calc_stats)
+        options.calc_stats->Add(calc.stats);
+#endif
+    return rating;
+}
+
+vector<DifficultyRating> MinaSDCalc(const vector<NoteInfo>& NoteInfo, float musicrate, const vector<float>& goals,
+                                    const CalcOptions& options) {
+    if (NoteInfo.empty())
+        return vector<DifficultyRating>(goals.size(), DifficultyRating {0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0});
+    return MinaSDCalc(PreparedChart(NoteInfo), musicrate, goals, options);
+}
+
+vector<DifficultyRating> MinaSDCalc(const PreparedChart& chart, float musicrate, const vector<float>& goals,
+                                    const CalcOptions& options) {
+    if (chart.empty())
+        return vector<DifficultyRating>(goals.size(), DifficultyRating {0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0});
+    auto calc = std::make_unique<Calc>();
+    calc->options = options;
+    vector<DifficultyRating> ratings = calc->CalcGoals(chart, musicrate, goals);
+    if (options.search_stats)
+        options.search_stats->Add(calc->evaluations);
+#ifdef MINACALC_STATS
+    if (options.calc_stats)
+        options.calc_stats->Add(calc->stats);
+#endif
+    return ratings;
 }
 
 // Wrap difficulty calculation for all rates from 0.7 to 2.1, with 0.1
 // step
 MinaSD MinaSDCalc(const vector<NoteInfo>& NoteInfo) {
-    MinaSD allrates;
+    return MinaSDCalc(NoteInfo, [](size_t count, const std::function<void(size_t)>& job) {
+        for (size_t i = 0; i < count; i++)
+            job(i);
+    });
+}
+
+MinaSD MinaSDCalc(const vector<NoteInfo>& NoteInfo, const CalcExecutor& executor) {
     int lower_rate = 7;
     int upper_rate = 21;
-
-    if (!NoteInfo.empty())
-        for (int i = lower_rate; i < upper_rate; i++)
-            allrates.push_back(MinaSDCalc(NoteInfo, static_cast<float>(i) / 10.f, 0.93f));
-    else {
-        DifficultyRating output{0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f};
-        for (int i = lower_rate; i < upper_rate; i++)
-            allrates.push_back(output);
+    MinaSD allrates(upper_rate - lower_rate, DifficultyRating {0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f});
+
+    // The rates share one PreparedChart. Each task writes only its own slot
+    // in `allrates` and rates in the workspace of the thread it runs on, so
+    // the order they run in doesn't matter
+    if (!NoteInfo.empty()) {
+        PreparedChart chart(NoteInfo);
+        executor(allrates.size(), [&](size_t i) {
+            int rate = lower_rate + static_cast<int>(i);
+            allrates[i] = MinaSDCalc(chart, static_cast<float>(rate) / 10.f, 0.93f);
+        });
     }
     return allrates;
 }
 
+MinaSD MinaSDCalc(const vector<NoteInfo>& NoteInfo, ThreadPool& pool) {
+    return MinaSDCalc(NoteInfo, PoolExecutor(pool));
+}
+
+CalcExecutor PoolExecutor(ThreadPool& pool) {
+    return [&pool](size_t count, const std::function<void(size_t)>& job) {
+        pool.ParallelFor(count, job);
+    };
+}
+
 int GetCalcVersion() {
     return -1;
 }
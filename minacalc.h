@@ -1,5 +1,11 @@
 #pragma once
 #include "NoteDataStructures.h"
+#include "calckernels.h"
+#include "intervallist.h"
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
 #include <vector>
 
 // For internal, must be preprocessor defined
@@ -13,11 +19,209 @@
 #endif
 
 typedef std::vector<DifficultyRating> MinaSD;
-typedef std::vector<std::vector<float>> Finger;
+typedef IntervalList<float> Finger; // ms from the last note in the column, for each note of each interval
 typedef std::vector<Finger> ProcessedFingers;
 typedef std::vector<float> JackSeq; // Vector of a local jack speed difficulty for each row
 
 enum ChiselType { STREAM, JS, HS, TECH, JACK };
+// Number of ChiselTypes that are calculated per hand (all but JACK)
+const int NUM_HAND_CHISELTYPES = 4;
+// The chisels CalcMain runs are one per ChiselType and then the stamina
+// one, which SearchStats::chisel and the like are indexed by
+const int STAMINA_CHISEL = JACK + 1;
+const int NUM_CHISELS = STAMINA_CHISEL + 1;
+// Most player skills a chisel scores in one pass, see CalcOptions::probes
+const int MAX_PROBES = 8;
+
+/* Runs job(0) ... job(count - 1), in any order and possibly concurrently,
+and returns once all of them have finished. Lets the caller hand the
+calculator its own threads. */
+typedef std::function<void(size_t count, const std::function<void(size_t)>& job)> CalcExecutor;
+
+class ThreadPool;
+
+// How Chisel and AggregateScores look for the skill at which a score goal
+// is reached
+enum SearchMode {
+    LINEAR_SEARCH, // Step up, step back and halve the step; the reference
+    BISECT_SEARCH, // Bracket the goal, then bisect
+    ILLINOIS_SEARCH // Bracket the goal, then regula falsi with the Illinois fix
+};
+
+// Number of score evaluations made by the searches
+struct SearchStats
+{
+    int chisel[NUM_CHISELS] = {}; // See STAMINA_CHISEL
+    int aggregate = 0; // Both AggregateScores calls
+
+    void Add(const SearchStats& other);
+    int Total() const;
+};
+
+/* Where the time of a calculation went, for finding out why a chart is slow.
+Only filled in when the calc is built with MINACALC_STATS defined (cmake
+-DMINACALC_STATS=ON); otherwise the hooks compile to nothing and this is
+never touched. Times are wall clock seconds. */
+struct CalcStats
+{
+    enum Phase {
+        CALC_MAIN, // All of CalcMain, so including the phases below
+        INIT, // All of Init
+        PROCESS_ROWS,
+        INIT_HAND, // Both hands, including their pattern scalers
+        OHJUMP_SCALER,
+        ANCHOR_SCALER,
+        ROLL_SCALER,
+        HS_SCALER,
+        JUMP_SCALER,
+        FINGERBIAS,
+        CHISEL_STREAM, // CHISEL_STREAM + ChiselType for the skillset chisels
+        CHISEL_JS,
+        CHISEL_HS,
+        CHISEL_TECH,
+        CHISEL_JACK,
+        CHISEL_STAMINA,
+        NUM_PHASES
+    };
+    static const char* PhaseName(int phase);
+
+    double seconds[NUM_PHASES] = {};
+    // CalcScoreForPlayerSkill calls, indexed like SearchStats::chisel
+    unsigned long long score_calls[NUM_CHISELS] = {};
+    unsigned long long jack_loss_calls = 0;
+    unsigned long long stam_adjust_calls = 0;
+    unsigned long long calculations = 0; // CalcMain calls
+    unsigned long long intervals = 0;
+    // Capacity of the per rate working storage (see Calc::ReservedBytes),
+    // not what was allocated to get there. The largest of them once stats
+    // are added up.
+    unsigned long long reserved_bytes = 0;
+
+    void Add(const CalcStats& other);
+    unsigned long long ScoreCalls() const;
+};
+
+#ifdef MINACALC_STATS
+const bool CALC_STATS_ENABLED = true;
+#else
+const bool CALC_STATS_ENABLED = false;
+#endif
+
+// The parts of CalcMain a CalcObserver is told about
+enum CalcPhase {
+    INIT_PHASE, // Calc::Init: the pass over the rows, the hands and their pattern scalers
+    SKILLSET_PHASE, // The STREAM, JS, HS, TECH and JACK chisels
+    STAMINA_PHASE, // The stamina chisel
+    NUM_CALC_PHASES
+};
+
+/* Gets told when CalcMain enters and leaves each CalcPhase, e.g. to read
+hardware counters around them. Called on the thread running CalcMain; with
+an executor, the skillset chisels run on other threads in between. */
+class CalcObserver
+{
+public:
+    virtual ~CalcObserver() = default;
+    virtual void PhaseBegin(CalcPhase phase) = 0;
+    virtual void PhaseEnd(CalcPhase phase) = 0;
+};
+
+// Knobs for how the calculator runs. The defaults are the plain serial
+// calculation; unless noted, none of these change the resulting ratings.
+struct CalcOptions
+{
+    // If set, CalcMain runs the independent skillset chisels through it
+    CalcExecutor executor;
+
+    // Use the vectorised pow approximation for the expected points of the
+    // hand based skillsets. Can move ratings slightly, see calckernels.h.
+    bool fast_points = false;
+    // Evaluate the scores of the STREAM, JS, HS and TECH chisels with a
+    // binary search over the sorted difficulties instead of a pass over
+    // all intervals. Takes 7-20% off a MinaSDCalc, the sorting included;
+    // can move ratings slightly, see SortedPoints in calckernels.h.
+    // Stamina isn't affected.
+    bool sorted_points = false;
+
+    // The bracketed modes reach the same precision as the linear search,
+    // but the chisels can land anywhere within it (JACK, whose score isn't
+    // increasing everywhere, anywhere it crosses the goal within a step),
+    // and CalcRatings can make more of that. See approximate().
+    SearchMode search = LINEAR_SEARCH;
+    // A bracketed search gives up after this many evaluations
+    int search_max_evals = 64;
+    // Player skills the chisels score per pass over the intervals, 1 to
+    // MAX_PROBES (others are clamped). With more than one, the linear
+    // search scores its next steps ahead of time and gives the same
+    // ratings; the bracketed modes split the bracket into probes + 1 parts
+    // per pass instead of narrowing it one probe at a time, which can move
+    // ratings within their precision. See approximate_probes(). The skills
+    // share the loads and divisions (see ExpectedPointsMulti), but each
+    // still needs its own pows, so only 2 with the linear search comes out
+    // ahead, by 6-10%; more score steps the search doesn't get to. With
+    // fast_points, or sorted_points without stamina, every skill is scored
+    // on its own and this only adds evaluations.
+    int probes = 1;
+
+    // If set, each calculation adds its evaluation counts to it
+    SearchStats* search_stats = nullptr;
+    // Same, for the instrumentation; only with CALC_STATS_ENABLED
+    CalcStats* calc_stats = nullptr;
+    // If set, told about the phases of every CalcMain
+    CalcObserver* observer = nullptr;
+};
+
+/* Everything the calculator needs from a chart that doesn't depend on the
+music rate. Building this is the only full scan over the NoteInfo; each rate
+then makes one pass over the rows (Calc::ProcessRows) to rescale them and
+bucket them into its own 0.5s intervals. Rows are expected in chronological
+order, like the game and the loader produce them. */
+class PreparedChart
+{
+public:
+    PreparedChart() = default;
+    explicit PreparedChart(const std::vector<NoteInfo>& note_info);
+
+    // Makes this the chart of `note_info`, reusing the memory
+    void Assign(const std::vector<NoteInfo>& note_info);
+    // Empties the chart but keeps the memory, e.g. to AddRow another one
+    void Clear();
+
+    // For building one from rows that aren't in a vector<NoteInfo> (e.g.
+    // straight out of a ChartCache): AddRow every row in order, then Finish
+    void AddRow(const NoteInfo& row);
+    void Finish();
+
+    // Edits of a finished chart of note rows (see CalcSession). InsertRow
+    // puts the row after the ones at the same time and returns its index,
+    // RemoveRow takes out the row at `index`. Both leave last_row_time at
+    // the last row's time.
+    size_t InsertRow(const NoteInfo& row);
+    void RemoveRow(size_t index);
+
+    // Rows that contain at least one tap, in chart order
+    std::vector<unsigned int> row_notes; // Row bitmasks
+    // Row times in seconds at 1.0x. These are kept unscaled instead of as
+    // ms deltas so that every rate divides the exact same values.
+    std::vector<float> row_times;
+    std::vector<unsigned int> row_taps; // Number of taps in each row
+
+    std::array<size_t, 4> column_taps = {}; // Number of taps in each column
+
+    float last_row_time = 0.f; // Time of the chart's last row, at 1.0x
+
+    // Proportion of taps that belong to jumps, hands and quads
+    float jump_proportion = 0.f;
+    float hand_proportion = 0.f;
+    float quad_proportion = 0.f;
+
+    bool empty() const { return row_notes.empty(); }
+
+private:
+    unsigned int taps = 0;
+    // Taps belonging to chords of size 2, 3 and 4
+    unsigned int chord_taps[5] = {0, 0, 0, 0, 0};
+};
 
 // The comments in here contain the concept of 'points'. That's
 // referring to Wifescore points, but scaled to a max of 1 (instead of
@@ -35,9 +239,9 @@ class Hand
 {
 public:
     /* Spits out a rough estimate of difficulty based on the ms values within
-    the interval The vector passed to it is the vector of ms values within each
-    interval, and not the full vector of intervals. */
-    static float CalcMSEstimate(std::vector<float>& input);
+    the interval The range passed to it is the ms values within one
+    interval, and not the full list of intervals. Sorts the range. */
+    static float CalcMSEstimate(IntervalRange<float> input);
 
     /* Averages nps and ms estimates for difficulty to get a rough initial
     value. This is relatively robust as patterns that get overrated by nps
@@ -49,26 +253,91 @@ public:
     // Totals up the points available for each interval
     void InitPoints(const Finger& f1, const Finger& f2);
 
+    /* Applies the pattern scalers to the NPS/MS difficulties once for every
+    ChiselType a hand is chiseled with, so CalcInternal doesn't have to redo
+    it for every player skill it's asked about. Call after the scalers are
+    set. */
+    void InitChiselDiffs();
+
+    // Running state of the stamina model while walking the intervals
+    struct StamState {
+        float floor = 1.f; // stamina multiplier min (increases as chart advances)
+        float multiplier = 1.f;
+        float last_diff = 0.f;
+    };
+
     /* The stamina model works by asserting a minimum difficulty relative to
     the supplied player skill level for which the player's stamina begins to
     wane. Experience in both gameplay and algorithm testing has shown the
     appropriate value to be around 0.8. The multiplier is scaled to the
-    proportionate difference in player skill. */
-    void StamAdjust(float x, std::vector<float>& diff);
+    proportionate difference in player skill. Takes the next interval's
+    difficulty and returns it adjusted. */
+    float StamAdjust(float x, float diff, StamState& state) const;
     
     /* For a given player skill level x, invokes the function used by wife
     scoring to assert the average of the distribution of point gain for each
     interval and then tallies up the result to produce an average total number
     of points achieved by this hand. */
-    float CalcInternal(float x, ChiselType flags, bool stam);
+    float CalcInternal(float x, ChiselType flags, bool stam) const;
+
+    // Where CalcInternal's sum is before some interval
+    struct Checkpoint {
+        float total = 0.f;
+        StamState stam;
+    };
+    // Whether CalcInternal takes the reference path for x, the one
+    // ResumeInternal carries on
+    bool Resumable(float x, bool stam) const { return !fast_points && (stam || !sorted_points || !(x > 0.f)); }
+    /* CalcInternal carried on from the last of `checkpoints` that's before
+    interval `valid`, checkpoints[k] being where the sum was before
+    interval span * k. The ones after it are made again on the way. For
+    Resumable skills only; the result is exactly CalcInternal's. */
+    float ResumeInternal(float x, ChiselType type, bool stam, size_t span, size_t valid,
+                         std::vector<Checkpoint>& checkpoints) const;
+    // CalcInternal for `count` player skills at once, in one pass over the
+    // intervals; each result is exactly CalcInternal's
+    void CalcInternals(const float* skills, size_t count, ChiselType type, bool stam, float* points) const;
+
+    /* InitDiff for the intervals f1 and f2 of one hand: their NPS and MS
+    difficulties before smoothing. Sorts the ranges like CalcMSEstimate. */
+    void IntervalDiff(IntervalRange<float> f1, IntervalRange<float> f2, float& nps_diff, float& ms_diff) const;
+
+    // InitChiselDiffs for the intervals first .. last - 1, with
+    // v_chiseldiff already sized
+    void UpdateChiselDiffs(size_t first, size_t last);
+
+    // Sorts the chisel difficulties into sorted_diffs if sorted_points is
+    // set. Call after the chisel difficulties are final.
+    void InitSortedPoints();
+
+    // Fully scaled difficulty of each interval for a hand based ChiselType
+    const float* ChiselDiff(ChiselType type) const { return &v_chiseldiff[type * v_itvpoints.size()]; }
 
     float fingerbias;
+    bool fast_points = false; // Use ExpectedPointsFast, see CalcOptions
+    bool sorted_points = false; // Use sorted_diffs, see CalcOptions
     std::vector<float> ohjumpscale, rollscale, hsscale, jumpscale, anchorscale;
     std::vector<int> v_itvpoints; // Max points for each interval
     std::vector<float> v_itvNPSdiff, v_itvMSdiff; // Calculated difficulty for each interval
+    // One block of numitv difficulties per hand based ChiselType (STREAM,
+    // JS, HS, TECH), back to back
+    std::vector<float> v_chiseldiff;
+    // v_chiseldiff's blocks as SortedPoints, when sorted_points is set
+    std::array<SortedPoints, NUM_HAND_CHISELTYPES> sorted_diffs;
 private:
+    friend class CalcSession;
+
     // Do we moving average the difficulty intervals?
     const bool SmoothDifficulty = true;
+
+    // Intervals the fast stamina path adjusts at a time before handing
+    // them to the kernel
+    static constexpr size_t StamBlock = 256;
+
+    // CalcInternal's reference stamina path over the intervals first ..
+    // last - 1, going on from `state` and adding onto `total`
+    float StamPoints(float x, const float* diff, const int* points, size_t first, size_t last, StamState& state,
+                     float total) const;
     
     float basescaler = 2.564f * 1.05f * 1.1f * 1.10f * 1.10f *
                         1.025; // multiplier to standardize baselines
@@ -80,6 +349,32 @@ private:
     const float prop = 0.75f; // proportion of player difficulty at which stamina tax begins
 };
 
+/* What CalcSession keeps of the scores of one Rate() for the next: for
+each player skill the chisels scored, the score and every so often where
+its sums were on the way, so a score can be carried on from the last
+checkpoint before the first edited interval (before the first edited note
+of each column for JACK). See Calc::ResumedScore. */
+struct ScoreCheckpoints
+{
+    static constexpr size_t IntervalSpan = 32; // Intervals between two checkpoints
+    static constexpr size_t NoteSpan = 64; // Notes between two JACK checkpoints
+
+    struct Score {
+        unsigned int generation = 0; // The Rate() that made it
+        float score = 0.f;
+        std::array<std::vector<Hand::Checkpoint>, 2> hands;
+        std::array<std::vector<JackWalk>, 4> columns;
+    };
+
+    // Indexed and keyed like Calc::remembered_scores
+    std::array<std::unordered_map<uint64_t, Score>, NUM_CHISELS> scores;
+    unsigned int generation = 1; // Of the Rate() going on
+    // The intervals before valid_intervals, and the first valid_notes[c]
+    // notes of each column, are the same as when the scores were made
+    size_t valid_intervals = 0;
+    std::array<size_t, 4> valid_notes = {0, 0, 0, 0};
+};
+
 class Calc
 {
 public:
@@ -88,34 +383,84 @@ public:
     to estimate difficulty for each different skillset. Currently only
     overall/stamina are being produced. */
     DifficultyRating CalcMain(const std::vector<NoteInfo>& NoteInfo, float music_rate, float score_goal);
+    DifficultyRating CalcMain(const PreparedChart& chart, float music_rate, float score_goal);
+    /* The part of CalcMain after Init: the chisels and the skillset
+    scaling. Of the chart it only reads last_row_time and the chord
+    proportions. */
+    DifficultyRating CalcRatings(const PreparedChart& chart, float score_goal);
+    /* CalcMain for several score goals at once, returning the ratings in
+    the order of `score_goals`. Init runs once, and the chisels remember
+    the scores they computed, which don't depend on the goal. Every search
+    starts out on the same steps, and nearby goals go on to probe the same
+    skills, so most evaluations are shared. The ratings are exactly
+    CalcMain's for each goal. */
+    std::vector<DifficultyRating> CalcGoals(const PreparedChart& chart, float music_rate,
+                                            const std::vector<float>& score_goals);
+
+    CalcOptions options;
 
     // redo these asap
     // Calculates the amount of points a player with player skill
-    // `x` will lose on a JackSeq `j`
+    // `x` will lose on a JackSeq `j`. The JACK chisel does all four
+    // columns at once instead, see JackLosses in calckernels.h.
     static float JackLoss(const std::vector<float>& j, float x);
-    // t=track index
-    // Generates a JackSeq from NoteInfo
-    static JackSeq SequenceJack(const std::vector<NoteInfo>& NoteInfo, unsigned int t, float music_rate);
     
     // Number of intervals
     int numitv;
+
+    // What the pattern scalers need to know about one interval
+    struct IntervalCounts {
+        int column_taps[4] = {0, 0, 0, 0}; // Taps in each column
+        int ohjumps[2] = {0, 0}; // Rows hitting both columns of the left/right hand
+        unsigned int taps = 0; // Taps in all columns
+        unsigned int jumps = 0; // Rows with exactly two taps
+        unsigned int hands = 0; // Rows with exactly three taps
+
+        // Counts a row with the bitmask `notes` holding `taps` taps
+        void AddRow(unsigned int notes, unsigned int taps) {
+            this->taps += taps;
+            if (taps == 2)
+                jumps++;
+            else if (taps == 3)
+                hands++;
+            if ((notes & 3u) == 3u)
+                ohjumps[0]++;
+            if ((notes & 12u) == 12u)
+                ohjumps[1]++;
+            for (unsigned int t = 0; t < 4; t++)
+                if (notes & (1u << t))
+                    column_taps[t]++;
+        }
+    };
     
-    float CalculateFingerbias(const std::vector<NoteInfo>& NoteInfo, unsigned int finger1, unsigned int finger2);
+    // f1, f2 = column indices
+    float CalculateFingerbias(int f1, int f2);
     
-    void Init(const std::vector<NoteInfo>& note_info, float music_rate, float score_goal);
+    void Init(const PreparedChart& chart, float music_rate);
+
+    /* The one pass over the chart for a rate. Slices the rows into predefined
+    intervals of time and fills in, all at once:
+     - itv_counts, the tap, jump and hand counts of each interval;
+     - fingers, where every tap has its ms value from the last note in the
+       same column put into its interval;
+     - jacks, the local jack speed difficulty at every tap of each column
+       (see the comment on JackDifficulty in minacalc.cpp). */
+    void ProcessRows(const PreparedChart& chart, float music_rate);
+
+    // Copies jacks into jack_lanes. ProcessRows does this; call it again
+    // after changing jacks.
+    void InterleaveJacks();
+    // The same after changing only the notes of each column c from
+    // first[c] on (past its length if none)
+    void InterleaveJacks(const std::array<size_t, 4>& first);
 
-    /* Splits up the chart by each hand and calls ProcessFinger on each "track"
-    before passing
-    the results to the hand initialization functions. Also passes the input
-    timingscale value. */
-    void InitHand(Hand& hand, const std::vector<NoteInfo>& note_info, int f1, int f2, float music_rate);
+    /* Passes the fingers of columns f1 and f2 to the hand initialization
+    functions and sets the hand's pattern scalers. Call after ProcessRows. */
+    void InitHand(Hand& hand, int f1, int f2);
 
-    /* Slices the track into predefined intervals of time. All taps within each
-    interval have their ms values from the last note in the same column
-    calculated and the result is spit out
-    into a new Finger object, or vector of vectors of floats (ms from last note
-    in the track). */
-    Finger ProcessFinger(const std::vector<NoteInfo>& NoteInfo, unsigned int t, float music_rate);
+    // Totals up MaxPoints and the fingerbias of both hands. Call after
+    // InitHand.
+    void InitTotals();
 
     float MaxPoints = 0.f; // Total points achievable in the file
 
@@ -131,41 +476,155 @@ public:
     
     // Used in Chisel()
     float CalcScoreForPlayerSkill(float player_skill, ChiselType type, bool stam);
+    // Same, but looked up first if CalcGoals already computed it
+    float RememberedScore(float player_skill, ChiselType type, bool stam);
+    // The same for `count` player skills (at most MAX_PROBES), into
+    // scores[0 .. count - 1], scored together, see Hand::CalcInternals.
+    // JACK scores them one after the other.
+    void CalcScoresForPlayerSkills(const float* skills, size_t count, ChiselType type, bool stam, float* scores);
+    void RememberedScores(const float* skills, size_t count, ChiselType type, bool stam, float* scores);
 
-    std::vector<float> OHJumpDownscaler(const std::vector<NoteInfo>& NoteInfo,
-                                        unsigned int t1,
-                                        unsigned int t2);
-    std::vector<float> Anchorscaler(const std::vector<NoteInfo>& NoteInfo,
-                                    unsigned int t1,
-                                    unsigned int t2);
-    std::vector<float> HSDownscaler(const std::vector<NoteInfo>& NoteInfo);
-    std::vector<float> JumpDownscaler(const std::vector<NoteInfo>& NoteInfo);
-    std::vector<float> RollDownscaler(const Finger& f1, const Finger& f2);
+    // Evaluations made by the last CalcMain
+    SearchStats evaluations;
+    // Instrumentation of the last CalcMain, see CalcStats
+    CalcStats stats;
+
+    // Bytes held by the per rate vectors Init fills (intervals, fingers,
+    // jacks and the hands' difficulties and scalers), by capacity
+    size_t ReservedBytes() const;
+
+    // These fill `output` with a scaler's value for every interval.
+    // hand = 0 for the left hand (columns 0 and 1), 1 for the right
+    void OHJumpDownscaler(int hand, std::vector<float>& output);
+    void Anchorscaler(int f1, int f2, std::vector<float>& output);
+    void HSDownscaler(std::vector<float>& output);
+    void JumpDownscaler(std::vector<float>& output);
+    void RollDownscaler(const Finger& f1, const Finger& f2, std::vector<float>& output);
 
     Hand left_hand;
     Hand right_hand;
 
 private:
+    friend class CalcSession;
+
+    // Index of the interval a row at `scaled_time` (seconds at the rate)
+    // falls into; the one ProcessRows puts it in
+    int IntervalOf(float scaled_time) const;
+
+    // What a tap adds to its Finger, given the ms since the column's last
+    // note
+    static float FingerValue(float interval_ms);
+    // Local jack speed difficulty from a column's three most recent note
+    // intervals in ms, interval3 being the newest. See ProcessRows.
+    static float JackDifficulty(float interval1, float interval2, float interval3);
+
+    // The pattern scalers' values for one interval, before smoothing
+    static float OHJumpScale(const IntervalCounts& counts, int hand);
+    static float AnchorScale(const IntervalCounts& counts, int f1, int f2);
+    static float HSScale(const IntervalCounts& counts);
+    static float JumpScale(const IntervalCounts& counts);
+    // `hand_intervals` is scratch space
+    static float RollScale(IntervalRange<const float> f1, IntervalRange<const float> f2,
+                           std::vector<float>& hand_intervals);
+
     float fingerbias;
-    std::vector<std::vector<int>> nervIntervals;
+
+    // Set during CalcGoals, see there
+    bool sweeping = false;
+    // Indexed like SearchStats::chisel, keyed by the ChiselType and the
+    // player skill's bits
+    std::array<std::unordered_map<uint64_t, float>, NUM_CHISELS> remembered_scores;
+    // Set by CalcSession; CalcScoreForPlayerSkill then goes through
+    // ResumedScore where it can
+    ScoreCheckpoints* checkpoints = nullptr;
+
+    /* CalcScoreForPlayerSkill from `checkpoints`: the score if this Rate()
+    already made it, else carried on from the last checkpoints still valid
+    and remembered with new ones. Exactly CalcScoreForPlayerSkill's. */
+    float ResumedScore(float player_skill, ChiselType type, bool stam);
+
+    // Filled by ProcessRows
+    std::vector<IntervalCounts> itv_counts;
+    std::array<Finger, 4> fingers;
+    std::array<JackSeq, 4> jacks;
+    // The jacks interleaved and padded for JackLosses
+    std::vector<float> jack_lanes;
+    std::array<size_t, 4> jack_lengths = {0, 0, 0, 0};
+    std::vector<float> roll_intervals; // Scratch space of RollDownscaler
 
     // Const calc params
     const bool SmoothPatterns = true; // Do we moving average the pattern modifier intervals?
     const float IntervalSpan = 0.5f; // Intervals of time we slice the chart at
     const bool logpatterns = false;
+};
 
-    JackSeq j0;
-    JackSeq j1;
-    JackSeq j2;
-    JackSeq j3;
+/* The buffers of one calculation, kept for the next one. Calc reuses the
+memory of its vectors when it's run again, so with a workspace per thread,
+rating a chart allocates only while the buffers grow to fit a longer chart
+than before. The MinaSDCalc overloads that don't take one use one kept by
+the calling thread, which holds on to the memory of the longest chart the
+thread rated until it exits. */
+struct CalcWorkspace
+{
+    PreparedChart chart; // Used by the NoteInfo overload of MinaSDCalc
+    Calc calc;
 };
 
 MINACALC_API DifficultyRating
 MinaSDCalc(const std::vector<NoteInfo>& NoteInfo,
            float musicrate,
            float goal);
+MINACALC_API DifficultyRating
+MinaSDCalc(const std::vector<NoteInfo>& NoteInfo,
+           float musicrate,
+           float goal,
+           const CalcOptions& options);
+// For callers rating the same chart more than once; skips the rate
+// independent preprocessing
+MINACALC_API DifficultyRating
+MinaSDCalc(const PreparedChart& chart,
+           float musicrate,
+           float goal,
+           const CalcOptions& options = CalcOptions());
+// The same, rated in `workspace`, see CalcWorkspace. Only one calculation
+// can use a workspace at a time.
+MINACALC_API DifficultyRating
+MinaSDCalc(const std::vector<NoteInfo>& NoteInfo,
+           float musicrate,
+           float goal,
+           CalcWorkspace& workspace,
+           const CalcOptions& options = CalcOptions());
+MINACALC_API DifficultyRating
+MinaSDCalc(const PreparedChart& chart,
+           float musicrate,
+           float goal,
+           CalcWorkspace& workspace,
+           const CalcOptions& options = CalcOptions());
+// Ratings for each of `goals` at one rate, see Calc::CalcGoals. Much
+// cheaper than a MinaSDCalc per goal.
+MINACALC_API std::vector<DifficultyRating>
+MinaSDCalc(const std::vector<NoteInfo>& NoteInfo,
+           float musicrate,
+           const std::vector<float>& goals,
+           const CalcOptions& options = CalcOptions());
+MINACALC_API std::vector<DifficultyRating>
+MinaSDCalc(const PreparedChart& chart,
+           float musicrate,
+           const std::vector<float>& goals,
+           const CalcOptions& options = CalcOptions());
 MINACALC_API MinaSD
 MinaSDCalc(const std::vector<NoteInfo>& NoteInfo);
+// Same as above, but the rates are computed concurrently via `executor`.
+// Results are identical to the serial version.
+MINACALC_API MinaSD
+MinaSDCalc(const std::vector<NoteInfo>& NoteInfo, const CalcExecutor& executor);
+MINACALC_API MinaSD
+MinaSDCalc(const std::vector<NoteInfo>& NoteInfo, ThreadPool& pool);
+// Executor that runs jobs on `pool`; nests safely inside pool tasks
+MINACALC_API CalcExecutor
+PoolExecutor(ThreadPool& pool);
+// Goes up with every change to the calc that can move a rating; cached
+// ratings of another version are thrown away (see RatingCache)
 MINACALC_API int
 GetCalcVersion();
 
@@ -0,0 +1,113 @@
+#include "perfcounters.h"
+
+#ifdef __linux__
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+const char* PerfSample::CounterName(int counter) {
+    static const char* const names[NUM_COUNTERS] = {"cycles", "instructions", "cache_misses", "branch_misses"};
+    return counter >= 0 && counter < NUM_COUNTERS ? names[counter] : "unknown";
+}
+
+void PerfSample::Add(const PerfSample& other) {
+    for (int i = 0; i < NUM_COUNTERS; i++)
+        values[i] += other.values[i];
+    seconds += other.seconds;
+    runs += other.runs;
+}
+
+#ifdef __linux__
+
+namespace {
+
+const uint64_t event_configs[PerfSample::NUM_COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+};
+
+int open_event(uint64_t config, int group_fd) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof attr);
+    attr.size = sizeof attr;
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = group_fd < 0 ? 1 : 0; // The group goes with its leader
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0));
+}
+
+} // namespace
+
+PerfCounters::PerfCounters() {
+    for (int i = 0; i < PerfSample::NUM_COUNTERS; i++) {
+        fds[i] = open_event(event_configs[i], leader);
+        if (fds[i] < 0) {
+            int open_error = errno;
+            if (error.empty())
+                error = std::string("perf_event_open(") + PerfSample::CounterName(i) + "): " + std::strerror(open_error);
+            continue;
+        }
+        if (leader < 0)
+            leader = fds[i];
+    }
+    if (Available())
+        error.clear();
+}
+
+PerfCounters::~PerfCounters() {
+    for (int fd : fds)
+        if (fd >= 0)
+            close(fd);
+}
+
+void PerfCounters::Start() {
+    if (Available()) {
+        ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+    start = std::chrono::steady_clock::now();
+}
+
+void PerfCounters::Stop(PerfSample& sample) {
+    auto end = std::chrono::steady_clock::now();
+    if (Available()) {
+        ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        for (int i = 0; i < PerfSample::NUM_COUNTERS; i++) {
+            // value, time enabled, time running
+            uint64_t data[3];
+            if (fds[i] < 0 || read(fds[i], data, sizeof data) != static_cast<ssize_t>(sizeof data))
+                continue;
+            // Scaled up if the kernel had to multiplex the counters
+            double value = static_cast<double>(data[0]);
+            if (data[2] > 0 && data[2] < data[1])
+                value *= static_cast<double>(data[1]) / static_cast<double>(data[2]);
+            sample.values[i] += static_cast<unsigned long long>(value);
+        }
+    }
+    sample.seconds += std::chrono::duration<double>(end - start).count();
+    sample.runs++;
+}
+
+#else
+
+PerfCounters::PerfCounters() : error("hardware counters are only supported on Linux") {}
+
+PerfCounters::~PerfCounters() = default;
+
+void PerfCounters::Start() {
+    start = std::chrono::steady_clock::now();
+}
+
+void PerfCounters::Stop(PerfSample& sample) {
+    sample.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    sample.runs++;
+}
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef MINACALC_PERFCOUNTERS_H
+#define MINACALC_PERFCOUNTERS_H
+
+#include <chrono>
+#include <string>
+
+// Counts collected over one or more stretches of code
+struct PerfSample {
+    enum Counter { CYCLES, INSTRUCTIONS, CACHE_MISSES, BRANCH_MISSES, NUM_COUNTERS };
+    static const char* CounterName(int counter);
+
+    unsigned long long values[NUM_COUNTERS] = {0, 0, 0, 0};
+    double seconds = 0; // Wall time, which is always there
+    unsigned long long runs = 0; // Start/Stop pairs added up in here
+
+    void Add(const PerfSample& other);
+};
+
+/* Hardware performance counters of the calling thread, through Linux's
+perf_event_open: cycles, instructions, cache misses and branch misses, opened
+as one group so they all count over the same stretch. User space only, which
+is what perf_event_paranoid 2 (the usual default) allows.
+
+Not every machine hands them out (no PMU in many VMs, a stricter
+perf_event_paranoid, seccomp, other platforms). Counters that can't be opened
+are left out and Has() is false for them; if none can, Available() is false,
+Error() says why, and Start/Stop only measure wall time. Counting is per
+thread, so whatever is measured has to run on the thread that created this. */
+class PerfCounters
+{
+public:
+    PerfCounters();
+    ~PerfCounters();
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    bool Available() const { return leader >= 0; }
+    bool Has(PerfSample::Counter counter) const { return fds[counter] >= 0; }
+    const std::string& Error() const { return error; }
+
+    void Start();
+    // Adds what was counted since Start to `sample`
+    void Stop(PerfSample& sample);
+
+private:
+    int fds[PerfSample::NUM_COUNTERS] = {-1, -1, -1, -1};
+    int leader = -1;
+    std::string error;
+    std::chrono::steady_clock::time_point start;
+};
+
+#endif //MINACALC_PERFCOUNTERS_H
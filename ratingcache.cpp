@@ -0,0 +1,309 @@
+#include "ratingcache.h"
+#include "contenthash.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+
+using std::string;
+using std::vector;
+
+namespace {
+
+const char store_magic[8] = {'M', 'I', 'N', 'A', 'R', 'A', 'T', 'E'};
+const uint32_t record_magic = 0x4d524352; // "RCRM"
+
+struct StoreHeader {
+    char magic[8];
+    uint32_t version;
+    int32_t calc_version;
+};
+
+struct StoreRecord {
+    uint32_t magic;
+    uint32_t options;
+    uint64_t chart_hash;
+    uint32_t rate;
+    uint32_t goal;
+    uint32_t max_evals;
+    uint32_t zero; // Keeps rating and checksum aligned
+    float rating[8];
+    uint64_t checksum; // content_hash of everything before it
+};
+
+static_assert(sizeof(StoreHeader) == 16, "store header must have no padding");
+static_assert(sizeof(StoreRecord) == 72, "store records must have no padding");
+static_assert(sizeof(DifficultyRating) == 8 * sizeof(float), "DifficultyRating must be 8 floats");
+
+uint32_t float_bits(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof bits);
+    return bits;
+}
+
+uint64_t record_checksum(const StoreRecord& record) {
+    return content_hash(&record, offsetof(StoreRecord, checksum));
+}
+
+bool record_valid(const StoreRecord& record) {
+    return record.magic == record_magic && record.checksum == record_checksum(record);
+}
+
+RatingKey record_key(const StoreRecord& record) {
+    RatingKey key;
+    key.chart_hash = record.chart_hash;
+    key.rate = record.rate;
+    key.goal = record.goal;
+    key.options = record.options;
+    key.max_evals = record.max_evals;
+    return key;
+}
+
+StoreHeader current_header() {
+    StoreHeader header;
+    std::memcpy(header.magic, store_magic, sizeof store_magic);
+    header.version = RATING_CACHE_VERSION;
+    header.calc_version = GetCalcVersion();
+    return header;
+}
+
+enum class StoreState { Missing, Current, Stale, Foreign };
+
+// Only a missing or empty file, or a store of another version, may be
+// replaced; anything else at `path` isn't ours to overwrite
+StoreState store_state(const string& path) {
+    std::error_code error;
+    if (!std::filesystem::exists(path, error))
+        return error ? StoreState::Foreign : StoreState::Missing;
+    if (std::filesystem::is_regular_file(path, error) && std::filesystem::file_size(path, error) == 0 && !error)
+        return StoreState::Missing;
+    std::ifstream in(path, std::ios::binary);
+    StoreHeader header;
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof header) ||
+        std::memcmp(header.magic, store_magic, sizeof store_magic) != 0)
+        return StoreState::Foreign;
+    StoreHeader current = current_header();
+    if (header.version != current.version || header.calc_version != current.calc_version)
+        return StoreState::Stale;
+    return StoreState::Current;
+}
+
+// Renamed into place, so a process that still has the old store open keeps
+// appending to that one instead of scribbling over the new header
+bool create_store(const string& path) {
+    string temp_path = path + ".tmp";
+    {
+        std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+        StoreHeader header = current_header();
+        if (!out.write(reinterpret_cast<const char*>(&header), sizeof header))
+            return false;
+    }
+    std::error_code error;
+    std::filesystem::rename(temp_path, path, error);
+    return !error;
+}
+
+} // namespace
+
+size_t RatingKeyHash::operator()(const RatingKey& key) const {
+    uint64_t h = key.chart_hash;
+    h ^= (static_cast<uint64_t>(key.rate) << 32 | key.goal) * 0x9e3779b97f4a7c15ull;
+    h ^= (static_cast<uint64_t>(key.max_evals) << 32 | key.options) * 0xc2b2ae3d27d4eb4full;
+    return static_cast<size_t>(h ^ (h >> 29));
+}
+
+/* Only the options that can move a rating go into the key: fast_points,
+sorted_points and the search mode in the options bits, plus the probes per
+pass (bits 4-6) and the evaluation cap (a field of its own) of the
+bracketed searches; the linear search gives the same ratings either way.
+The executor and search_stats don't change results. */
+RatingKey MakeRatingKey(uint64_t chart_hash, float musicrate, float goal, const CalcOptions& options) {
+    RatingKey key;
+    key.chart_hash = chart_hash;
+    key.rate = float_bits(musicrate);
+    key.goal = float_bits(goal);
+    key.options = (options.fast_points ? 1u : 0u) | static_cast<uint32_t>(options.search) << 1 |
+                  (options.sorted_points ? 1u << 3 : 0u);
+    if (options.search != LINEAR_SEARCH) {
+        key.options |= static_cast<uint32_t>(std::max(1, std::min(options.probes, MAX_PROBES)) - 1) << 4;
+        key.max_evals = static_cast<uint32_t>(options.search_max_evals);
+    }
+    return key;
+}
+
+RatingKey MakeRatingKey(const vector<NoteInfo>& notes, float musicrate, float goal,
+                        const CalcOptions& options) {
+    return MakeRatingKey(content_hash(notes.data(), notes.size() * sizeof(NoteInfo)), musicrate, goal, options);
+}
+
+RatingCache::RatingCache(size_t memory_entries) : memory_entries(memory_entries) {}
+
+RatingCache::~RatingCache() {
+    Close();
+}
+
+bool RatingCache::Open(const string& path) {
+    Close();
+    std::lock_guard<std::mutex> lock(mutex);
+
+    switch (store_state(path)) {
+    case StoreState::Current:
+        break;
+    case StoreState::Missing:
+    case StoreState::Stale:
+        if (!create_store(path))
+            return false;
+        break;
+    case StoreState::Foreign:
+        return false;
+    }
+    appender = std::fopen(path.c_str(), "ab");
+    reader.open(path, std::ios::binary);
+    if (!appender || !reader.is_open()) {
+        if (appender)
+            std::fclose(appender);
+        appender = nullptr;
+        reader.close();
+        return false;
+    }
+    scanned = sizeof(StoreHeader);
+    ScanStore();
+    return true;
+}
+
+void RatingCache::Close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (appender)
+        std::fclose(appender);
+    appender = nullptr;
+    reader.close();
+    scanned = 0;
+    disk.clear();
+}
+
+bool RatingCache::Get(const RatingKey& key, DifficultyRating& rating) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto cached = memory.find(key);
+    if (cached != memory.end()) {
+        lru.splice(lru.begin(), lru, cached->second);
+        rating = cached->second->second;
+        stats.memory_hits++;
+        return true;
+    }
+
+    auto stored = disk.find(key);
+    if (stored != disk.end() && ReadRecord(key, stored->second, rating)) {
+        Remember(key, rating);
+        stats.disk_hits++;
+        return true;
+    }
+
+    stats.misses++;
+    return false;
+}
+
+void RatingCache::Put(const RatingKey& key, const DifficultyRating& rating) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Remember(key, rating);
+    if (!appender || disk.count(key))
+        return;
+
+    StoreRecord record;
+    record.magic = record_magic;
+    record.options = key.options;
+    record.chart_hash = key.chart_hash;
+    record.rate = key.rate;
+    record.goal = key.goal;
+    record.max_evals = key.max_evals;
+    record.zero = 0;
+    std::memcpy(record.rating, &rating, sizeof record.rating);
+    record.checksum = record_checksum(record);
+
+    // One write per record, which O_APPEND puts at the end of the file as
+    // a whole, leaving the stream just past it
+    std::fwrite(&record, sizeof record, 1, appender);
+    if (std::fflush(appender) != 0)
+        return;
+    long end = std::ftell(appender);
+    if (end >= static_cast<long>(sizeof(StoreHeader) + sizeof record))
+        disk[key] = static_cast<uint64_t>(end) - sizeof record;
+}
+
+void RatingCache::Refresh() {
+    std::lock_guard<std::mutex> lock(mutex);
+    ScanStore();
+}
+
+RatingCache::Stats RatingCache::GetStats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    ScanStore();
+    Stats result = stats;
+    result.stored = disk.size();
+    return result;
+}
+
+void RatingCache::Remember(const RatingKey& key, const DifficultyRating& rating) {
+    if (memory_entries == 0)
+        return;
+    auto cached = memory.find(key);
+    if (cached != memory.end()) {
+        cached->second->second = rating;
+        lru.splice(lru.begin(), lru, cached->second);
+        return;
+    }
+    if (memory.size() >= memory_entries) {
+        memory.erase(lru.back().first);
+        lru.pop_back();
+    }
+    lru.emplace_front(key, rating);
+    memory[key] = lru.begin();
+}
+
+bool RatingCache::ReadRecord(const RatingKey& key, uint64_t offset, DifficultyRating& rating) {
+    StoreRecord record;
+    reader.clear();
+    reader.seekg(static_cast<std::streamoff>(offset));
+    if (!reader.read(reinterpret_cast<char*>(&record), sizeof record))
+        return false;
+    if (!record_valid(record) || !(record_key(record) == key))
+        return false;
+    std::memcpy(&rating, record.rating, sizeof record.rating);
+    return true;
+}
+
+/* Indexes every record from `scanned` to the end of the store. Whatever is
+left over at the end (less than a record, or a record still being written)
+is looked at again on the next scan. */
+void RatingCache::ScanStore() {
+    if (!reader.is_open())
+        return;
+    reader.clear();
+    reader.seekg(static_cast<std::streamoff>(scanned));
+
+    vector<char> chunk(1 << 16);
+    string pending;
+    uint64_t pending_offset = scanned;
+    for (;;) {
+        reader.read(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+        auto got = static_cast<size_t>(reader.gcount());
+        if (got == 0)
+            break;
+        pending.append(chunk.data(), got);
+
+        size_t pos = 0;
+        while (pending.size() - pos >= sizeof(StoreRecord)) {
+            StoreRecord record;
+            std::memcpy(&record, pending.data() + pos, sizeof record);
+            if (!record_valid(record)) {
+                pos++;
+                continue;
+            }
+            disk[record_key(record)] = pending_offset + pos;
+            pos += sizeof record;
+        }
+        pending.erase(0, pos);
+        pending_offset += pos;
+    }
+    scanned = pending_offset;
+}
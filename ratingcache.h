@@ -0,0 +1,122 @@
+#ifndef MINACALC_RATINGCACHE_H
+#define MINACALC_RATINGCACHE_H
+
+#include "minacalc.h"
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// What a rating depends on besides the calc itself. Rate and goal are kept as
+// bit patterns so that keys compare and hash exactly.
+struct RatingKey {
+    uint64_t chart_hash = 0; // content_hash of the chart's NoteInfo
+    uint32_t rate = 0;
+    uint32_t goal = 0;
+    uint32_t options = 0; // The CalcOptions that change ratings, see MakeRatingKey
+    uint32_t max_evals = 0; // search_max_evals of the bracketed searches, else 0
+
+    bool operator==(const RatingKey& other) const {
+        return chart_hash == other.chart_hash && rate == other.rate &&
+               goal == other.goal && options == other.options && max_evals == other.max_evals;
+    }
+};
+
+struct RatingKeyHash {
+    size_t operator()(const RatingKey& key) const;
+};
+
+RatingKey MakeRatingKey(const std::vector<NoteInfo>& notes, float musicrate, float goal,
+                        const CalcOptions& options);
+// For charts whose hash is already known, like those in a ChartCache
+RatingKey MakeRatingKey(uint64_t chart_hash, float musicrate, float goal, const CalcOptions& options);
+
+/* Remembers ratings across runs, so rating a mostly unchanged pack again only
+calculates the charts that changed.
+
+Two tiers: the most recently used ratings in memory, and a store on disk that
+every rating is appended to. The store is a header followed by fixed size
+records:
+    "MINARATE"                  magic
+    u32 version                 RATING_CACHE_VERSION
+    i32 calc version            GetCalcVersion() of the calc that wrote it
+    records of 72 bytes:
+        u32 magic, u32 options, u64 chart hash, u32 rate, u32 goal,
+        u32 max evals, u32 zero, 8 floats rating (DifficultyRating order),
+        u64 content_hash of the rest
+
+Records are written in native byte order, like content_hash, so a store only
+makes sense on machines of the same endianness. Each record goes out in a
+single append, so any number of processes can read the store and add to it at
+the same time. A record that got torn anyway (a crash, a file system without
+atomic appends) fails its checksum and is skipped; readers then look for the
+next record byte by byte. Only the memory tier and an index of key to record
+offset are kept in memory. The index is built on Open and kept up to date
+by Put; Refresh adds what other processes have appended since.
+
+A store written by another calc version, or another layout, is replaced by an
+empty one on Open, so ratings never outlive the calc that produced them. A
+file that isn't a store at all is left alone and Open fails. Bump
+RATING_CACHE_VERSION whenever the layout changes, or whenever the stores
+written so far have to go for some other reason. */
+const uint32_t RATING_CACHE_VERSION = 3;
+
+class RatingCache
+{
+public:
+    explicit RatingCache(size_t memory_entries = 1 << 16);
+    ~RatingCache();
+
+    RatingCache(const RatingCache&) = delete;
+    RatingCache& operator=(const RatingCache&) = delete;
+
+    /* Opens the store at `path`, creating it if there is none, and indexes
+    the ratings in it. Returns false if it can't be read or created, or if
+    `path` is some other file; the cache then only has its memory tier. */
+    bool Open(const std::string& path);
+    void Close();
+
+    // Memory first, then the store's index
+    bool Get(const RatingKey& key, DifficultyRating& rating);
+    // Adds the rating to both tiers. Keys the store already has aren't
+    // appended again.
+    void Put(const RatingKey& key, const DifficultyRating& rating);
+    // Indexes the ratings other processes have added to the store since it
+    // was last read
+    void Refresh();
+
+    struct Stats {
+        size_t memory_hits = 0;
+        size_t disk_hits = 0;
+        size_t misses = 0;
+        size_t stored = 0; // Distinct ratings in the store
+    };
+    Stats GetStats();
+
+private:
+    typedef std::list<std::pair<RatingKey, DifficultyRating>> LruList;
+
+    void Remember(const RatingKey& key, const DifficultyRating& rating);
+    bool ReadRecord(const RatingKey& key, uint64_t offset, DifficultyRating& rating);
+    void ScanStore();
+
+    std::mutex mutex;
+
+    // Most recently used at the front
+    size_t memory_entries;
+    LruList lru;
+    std::unordered_map<RatingKey, LruList::iterator, RatingKeyHash> memory;
+
+    std::ifstream reader;
+    std::FILE* appender = nullptr;
+    uint64_t scanned = 0; // How far into the store ScanStore has read
+    std::unordered_map<RatingKey, uint64_t, RatingKeyHash> disk;
+
+    Stats stats;
+};
+
+#endif //MINACALC_RATINGCACHE_H
@@ -0,0 +1,350 @@
+#include "calckernels.h"
+#include "chartgen.h"
+#include "minacalc.h"
+#include "smloader.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+/* minacalc_regression
+
+Checks the optional paths of the calc against the default one on generated
+charts (see chartgen.h): the ones that promise the same ratings have to give
+exactly the same bits, the others have to stay within what they document.
+Prints every failed check and exits with 1 if there were any. Run by ctest. */
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const string& what) {
+    if (ok)
+        return;
+    failures++;
+    std::cerr << "FAIL: " << what << '\n';
+}
+
+struct TestChart {
+    string name;
+    vector<NoteInfo> notes;
+};
+
+// Every pattern at a few lengths, with two seeds each
+const vector<TestChart>& test_charts() {
+    static const vector<TestChart> charts = [] {
+        vector<TestChart> generated;
+        for (int p = 0; p < NUM_CHART_PATTERNS; p++)
+            for (float seconds : {20.f, 90.f, 240.f})
+                for (uint64_t seed : {1, 2}) {
+                    ChartGenOptions options;
+                    options.pattern = static_cast<ChartPattern>(p);
+                    options.seconds = seconds;
+                    options.seed = seed;
+                    string name = string(pattern_name(options.pattern)) + " " + std::to_string(static_cast<int>(seconds)) +
+                                  "s seed " + std::to_string(seed);
+                    generated.push_back(TestChart {name, load_from_buffer(generate_sm(options))[0].notes});
+                }
+        return generated;
+    }();
+    return charts;
+}
+
+const float test_rates[] = {0.8f, 1.f, 1.5f};
+const float test_goals[] = {0.8f, 0.93f, 0.965f};
+
+const float* fields(const DifficultyRating& rating) {
+    return &rating.overall;
+}
+
+const char* const field_names[8] = {"overall", "stream", "jumpstream", "handstream",
+                                    "stamina", "jack", "chordjack", "technical"};
+
+string describe(const TestChart& chart, float rate, float goal) {
+    return chart.name + " at " + std::to_string(rate) + "x, goal " + std::to_string(goal);
+}
+
+// Checks every field of `got` against `expected`, bit for bit if `tolerance`
+// is 0
+void check_rating(const DifficultyRating& got, const DifficultyRating& expected, float tolerance,
+                  const string& what) {
+    for (int f = 0; f < 8; f++) {
+        float a = fields(got)[f];
+        float b = fields(expected)[f];
+        bool ok = tolerance == 0.f ? std::memcmp(&a, &b, sizeof a) == 0 : std::fabs(a - b) <= tolerance;
+        check(ok, what + ": " + field_names[f] + " " + std::to_string(a) + " instead of " + std::to_string(b));
+    }
+}
+
+// MinaSDCalc with `options` against the default on every test chart, rate
+// and goal
+void compare_ratings(const string& name, const CalcOptions& options, float tolerance) {
+    for (const TestChart& chart : test_charts())
+        for (float rate : test_rates)
+            for (float goal : test_goals)
+                check_rating(MinaSDCalc(chart.notes, rate, goal, options), MinaSDCalc(chart.notes, rate, goal),
+                             tolerance, name + ", " + describe(chart, rate, goal));
+}
+
+// splitmix64, for the kernel inputs
+class Random
+{
+public:
+    explicit Random(uint64_t seed) : state(seed) {}
+
+    uint64_t Next() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    // In [low, high)
+    float Uniform(float low, float high) {
+        return low + (high - low) * static_cast<float>(Next() >> 40) / static_cast<float>(1 << 24);
+    }
+
+private:
+    uint64_t state;
+};
+
+/* ExpectedPointsFast against ExpectedPoints on random intervals. Every term
+is within 5e-7 of std::pow for the ratios used here, and the sums only
+differ by the order they're added up in, so 1e-5 relative is plenty. The
+ratings may move by one step of a chisel's final resolution, which after
+the scaling in CalcRatings stays below 0.1. */
+void test_fast_points() {
+    Random random(6);
+    for (size_t n : {0, 1, 7, 8, 9, 100, 1001}) {
+        vector<float> diff(n);
+        vector<int> points(n);
+        for (size_t i = 0; i < n; i++) {
+            diff[i] = random.Uniform(0.5f, 40.f);
+            points[i] = static_cast<int>(random.Uniform(0.f, 9.f));
+        }
+        for (float skill : {-1.f, 0.f, 0.05f, 1.f, 7.5f, 20.f, 45.f}) {
+            float fast = ExpectedPointsFast(skill, diff.data(), points.data(), n);
+            float reference = ExpectedPoints(skill, diff.data(), points.data(), n);
+            bool ok = skill > 0.f ? std::fabs(fast - reference) <= 1e-5f * std::fabs(reference) + 1e-6f
+                                  : std::memcmp(&fast, &reference, sizeof fast) == 0 ||
+                                        (std::isnan(fast) && std::isnan(reference));
+            check(ok, "ExpectedPointsFast(" + std::to_string(skill) + ") over " + std::to_string(n) +
+                          " intervals is " + std::to_string(fast) + " instead of " + std::to_string(reference));
+        }
+    }
+
+    CalcOptions options;
+    options.fast_points = true;
+    compare_ratings("fast_points", options, 0.1f);
+}
+
+/* The multi-goal MinaSDCalc against one MinaSDCalc per goal, bit for bit,
+with the options that change how the remembered scores are looked up: the
+probes of approximate_probes and the bracketed searches. The goals are out
+of order and repeat, like a caller's list might. */
+void test_multiple_goals() {
+    vector<float> goals;
+    for (int g = 99; g >= 80; g--)
+        goals.push_back(static_cast<float>(g) / 100.f);
+    goals.push_back(0.965f);
+    goals.push_back(0.93f);
+
+    CalcOptions probes;
+    probes.probes = 2;
+    CalcOptions bisect;
+    bisect.search = BISECT_SEARCH;
+    const std::pair<string, CalcOptions> variants[] = {{"default", CalcOptions()}, {"probes 2", probes},
+                                                       {"bisect search", bisect}};
+    for (const auto& variant : variants)
+        for (const TestChart& chart : test_charts())
+            for (float rate : test_rates) {
+                vector<DifficultyRating> ratings = MinaSDCalc(chart.notes, rate, goals, variant.second);
+                check(ratings.size() == goals.size(), "goals, " + variant.first + ": " +
+                                                          std::to_string(ratings.size()) + " ratings");
+                for (size_t g = 0; g < goals.size() && g < ratings.size(); g++)
+                    check_rating(ratings[g], MinaSDCalc(chart.notes, rate, goals[g], variant.second), 0.f,
+                                 "goals, " + variant.first + ", " + describe(chart, rate, goals[g]));
+            }
+}
+
+/* JackLosses against JackLoss column by column, bit for bit, on random
+columns of different lengths (one of them often empty). The diffs range
+from well below to far above the skills, so notes lose points and the
+multiplier hits its ceiling. The JACK chisel only goes through JackLosses,
+so this is what keeps its ratings the same. */
+void test_jack_losses() {
+    Random random(23);
+    for (int round = 0; round < 200; round++) {
+        size_t lengths[4];
+        vector<float> columns[4];
+        size_t rows = 0;
+        for (int c = 0; c < 4; c++) {
+            lengths[c] = static_cast<size_t>(random.Uniform(0.f, 1.f) < 0.2f ? 0.f : random.Uniform(0.f, 300.f));
+            columns[c].resize(lengths[c]);
+            for (float& jd : columns[c])
+                jd = random.Uniform(0.f, 1.f) < 0.1f ? random.Uniform(50.f, 400.f) : random.Uniform(0.f, 40.f);
+            rows = std::max(rows, lengths[c]);
+        }
+        // Interleaved like Calc::InterleaveJacks, padded with garbage that
+        // has to be ignored
+        vector<float> lanes(4 * rows, 1e30f);
+        for (int c = 0; c < 4; c++)
+            for (size_t k = 0; k < lengths[c]; k++)
+                lanes[4 * k + c] = columns[c][k];
+
+        for (float skill : {0.5f, 5.f, 12.f, 25.f, 60.f}) {
+            float losses[4];
+            JackLosses(skill, lanes.data(), lengths, losses);
+            for (int c = 0; c < 4; c++) {
+                float expected = JackLoss(skill, columns[c].data(), lengths[c]);
+                check(std::memcmp(&losses[c], &expected, sizeof expected) == 0,
+                      "JackLosses(" + std::to_string(skill) + ") column " + std::to_string(c) + " of " +
+                          std::to_string(lengths[c]) + " notes is " + std::to_string(losses[c]) + " instead of " +
+                          std::to_string(expected));
+            }
+        }
+    }
+}
+
+/* ExpectedPointsMulti against ExpectedPoints skill by skill, bit for bit,
+for every count up to MAX_PROBES, with skills on both sides of the diffs
+and the diffs of 0 of empty intervals. Then the linear search with more
+probes than the tests of the other paths use, which has to give the same
+ratings. */
+void test_multi_points() {
+    Random random(24);
+    for (size_t n : {0, 1, 5, 100, 1001}) {
+        vector<float> diff(n);
+        vector<int> points(n);
+        for (size_t i = 0; i < n; i++) {
+            bool empty = random.Uniform(0.f, 1.f) < 0.1f;
+            diff[i] = empty ? 0.f : random.Uniform(0.5f, 40.f);
+            points[i] = empty ? 0 : static_cast<int>(random.Uniform(1.f, 9.f));
+        }
+        for (size_t count = 1; count <= MAX_PROBES; count++) {
+            float skills[MAX_PROBES];
+            for (size_t k = 0; k < count; k++)
+                skills[k] = k == 0 && n == 100 ? 0.f : random.Uniform(-1.f, 45.f);
+            float totals[MAX_PROBES];
+            ExpectedPointsMulti(skills, count, diff.data(), points.data(), n, totals);
+            for (size_t k = 0; k < count; k++) {
+                float expected = ExpectedPoints(skills[k], diff.data(), points.data(), n);
+                check(std::memcmp(&totals[k], &expected, sizeof expected) == 0,
+                      "ExpectedPointsMulti skill " + std::to_string(k) + " of " + std::to_string(count) + " (" +
+                          std::to_string(skills[k]) + ") over " + std::to_string(n) + " intervals is " +
+                          std::to_string(totals[k]) + " instead of " + std::to_string(expected));
+            }
+        }
+    }
+
+    CalcOptions options;
+    options.probes = 5;
+    compare_ratings("probes 5", options, 0.f);
+}
+
+/* SortedPoints against ExpectedPoints on random intervals, some of them
+without points or with a diff of 0 like the empty intervals of a chart.
+Summing in double in another order keeps the totals within 1e-5 relative,
+and the ratings move like with ExpectedPointsFast. */
+void test_sorted_points() {
+    Random random(22);
+    SortedPoints sorted;
+    for (size_t n : {0, 1, 2, 100, 1001}) {
+        vector<float> diff(n);
+        vector<int> points(n);
+        for (size_t i = 0; i < n; i++) {
+            bool empty = random.Uniform(0.f, 1.f) < 0.1f;
+            diff[i] = empty ? 0.f : random.Uniform(0.5f, 40.f);
+            points[i] = empty ? 0 : static_cast<int>(random.Uniform(1.f, 9.f));
+        }
+        sorted.Assign(diff.data(), points.data(), n);
+        for (float skill : {0.05f, 1.f, 7.5f, 20.f, 45.f}) {
+            float got = sorted.ExpectedPoints(skill);
+            float reference = ExpectedPoints(skill, diff.data(), points.data(), n);
+            check(std::fabs(got - reference) <= 1e-5f * std::fabs(reference) + 1e-6f,
+                  "SortedPoints(" + std::to_string(skill) + ") over " + std::to_string(n) + " intervals is " +
+                      std::to_string(got) + " instead of " + std::to_string(reference));
+        }
+    }
+
+    CalcOptions options;
+    options.sorted_points = true;
+    compare_ratings("sorted_points", options, 0.1f);
+}
+
+/* The chisels with the bracketed searches against the linear one. Both
+stop within their tolerance, resolution / 2^6, above where the score goal
+is reached (see approximate()), so they can't be further apart than that.
+JACK only has to reach the
+goal in the same step of the walk up, see below. The ratings aren't
+compared: CalcRatings turns steps that small into much
+bigger ones, e.g. when technical stops being the highest skillset. */
+void test_bracketed_search() {
+    const ChiselType types[] = {STREAM, JS, HS, TECH, JACK};
+    for (SearchMode search : {BISECT_SEARCH, ILLINOIS_SEARCH}) {
+        string name = search == BISECT_SEARCH ? "bisect search" : "illinois search";
+        for (const TestChart& chart : test_charts()) {
+            PreparedChart prepared(chart.notes);
+            for (float rate : test_rates)
+                for (float goal : test_goals) {
+                    auto linear = std::make_unique<Calc>();
+                    auto bracketed = std::make_unique<Calc>();
+                    bracketed->options.search = search;
+                    linear->Init(prepared, rate);
+                    bracketed->Init(prepared, rate);
+                    for (ChiselType type : types) {
+                        float a = bracketed->Chisel(0.1f, 10.24f, goal, type, false);
+                        float b = linear->Chisel(0.1f, 10.24f, goal, type, false);
+                        if (type == JACK) {
+                            // The JACK score isn't increasing everywhere, so
+                            // the searches can find different crossings
+                            // within the first step that reaches the goal
+                            check(linear->CalcScoreForPlayerSkill(a, JACK, false) >= goal &&
+                                      std::fabs(a - b) <= 10.24f,
+                                  name + ", " + describe(chart, rate, goal) + ": JACK chisel " +
+                                      std::to_string(a) + " isn't where the goal is reached");
+                            continue;
+                        }
+                        check(std::fabs(a - b) <= 10.24f / 64.f,
+                              name + ", " + describe(chart, rate, goal) + ": chisel " + std::to_string(type) +
+                                  " " + std::to_string(a) + " instead of " + std::to_string(b));
+                        // The stamina chisels, from where CalcRatings would
+                        // start them
+                        a = bracketed->Chisel(b - 0.1f, 2.56f, goal, type, true);
+                        b = linear->Chisel(b - 0.1f, 2.56f, goal, type, true);
+                        check(std::fabs(a - b) <= 2.56f / 64.f,
+                              name + ", " + describe(chart, rate, goal) + ": stamina chisel " +
+                                  std::to_string(type) + " " + std::to_string(a) + " instead of " +
+                                  std::to_string(b));
+                    }
+                }
+        }
+    }
+}
+
+} // namespace
+
+int main() {
+    std::cerr << "fast pow kernel: " << FastKernelName() << '\n';
+    test_fast_points();
+    test_sorted_points();
+    test_jack_losses();
+    test_multi_points();
+    test_multiple_goals();
+    test_bracketed_search();
+
+    if (failures > 0) {
+        std::cerr << failures << " checks failed\n";
+        return 1;
+    }
+    std::cerr << "all checks passed\n";
+    return 0;
+}
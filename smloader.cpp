@@ -2,21 +2,44 @@
 // Created by Robert on 10/28/2019.
 //
 
-#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
-#include <cctype>
+#include <limits>
+#include <string>
 #include "smloader.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SMLOADER_SSE2
+#include <emmintrin.h>
+#endif
+
 using std::vector;
-using std::stringstream;
 using std::string;
-vector<NoteInfo> parse_main_block(stringstream&);
-BPMs parse_bpms_block(stringstream&);
+using std::string_view;
+vector<NoteInfo> parse_main_block(string_view);
+BPMs parse_bpms_block(string_view);
 
 SMNotes load_from_file(std::ifstream& file) {
-    stringstream sm_buffer;
-    sm_buffer << file.rdbuf();
-    string sm_text = sm_buffer.str();
+    string sm_text;
+    file.seekg(0, std::ios::end);
+    std::streamoff size = file.tellg();
+    file.seekg(0, std::ios::beg);
+    if (size > 0) {
+        sm_text.resize(static_cast<size_t>(size));
+        file.read(&sm_text[0], size);
+        // Less than size in text mode on Windows
+        sm_text.resize(static_cast<size_t>(file.gcount()));
+    }
+    return load_from_buffer(sm_text);
+}
+
+// Every substr below is on a view, so moving along the text is O(1) instead
+// of copying the rest of the file each time
+SMNotes load_from_buffer(string_view sm_text) {
     SMNotes raw_block;
     BPMs bpms;
     while (!sm_text.empty()) {
@@ -31,120 +54,380 @@ SMNotes load_from_file(std::ifstream& file) {
                     break;
                 sm_text = sm_text.substr(next_tag_position + 1);
             }
-            std::string difficulty_name = sm_text.substr(0,sm_text.find(':'));
+            std::string difficulty_name(sm_text.substr(0,sm_text.find(':')));
             for (int i = 0; i < 3; i++) {
                 next_tag_position = sm_text.find(':');
                 if (next_tag_position == string::npos)
                     break;
                 sm_text = sm_text.substr(next_tag_position + 1);
             }
-            stringstream notes_block;
             next_tag_position = sm_text.find(';');
-            notes_block << sm_text.substr(sm_text.find('\n')+1, next_tag_position-1);
+            string_view notes_block = sm_text.substr(sm_text.find('\n')+1, next_tag_position-1);
             raw_block.push_back(ChartInfo {difficulty_name, parse_main_block(notes_block)});
             sm_text = sm_text.substr(next_tag_position + 1);
         } else if (sm_text.substr(0,4) == "BPMS") {
             next_tag_position = sm_text.find(':');
             sm_text = sm_text.substr(next_tag_position + 1);
             next_tag_position = sm_text.find(';');
-            stringstream bpms_block;
-            bpms_block << sm_text.substr(0, next_tag_position);
-            bpms = parse_bpms_block(bpms_block);
+            bpms = parse_bpms_block(sm_text.substr(0, next_tag_position));
             sm_text = sm_text.substr(next_tag_position + 1);
         }
     }
-    for (ChartInfo& chart : raw_block)
-        for (NoteInfo& timestamp : chart.notes) {
-            int next_bpm_index = 0;
-            float last_bpm = 120.f;
-            float last_bpm_time = 0.f;
-            float last_bpm_beat = 0.f;
-            while (next_bpm_index < bpms.size() && bpms[next_bpm_index].beat <= timestamp.rowTime) {
-                last_bpm_time += (bpms[next_bpm_index].beat - last_bpm_beat) * 240.f / last_bpm;
-                last_bpm_beat = bpms[next_bpm_index].beat;
-                last_bpm = bpms[next_bpm_index].bpm;
-                next_bpm_index += 1;
-            }
-            timestamp.rowTime = last_bpm_time + (timestamp.rowTime - last_bpm_beat) * 240.f / last_bpm;
-        }
+    TimingData timing(bpms);
+    for (ChartInfo& chart : raw_block) {
+        // Rows come out of parse_main_block in order
+        size_t segment = 0;
+        for (NoteInfo& timestamp : chart.notes)
+            timestamp.rowTime = timing.BeatToSeconds(timestamp.rowTime, segment);
+    }
     return raw_block;
 }
 
-vector<NoteInfo> parse_main_block(stringstream& sm_text) {
-    vector<NoteInfo> output;
-    int notes;
-    int column_value;
+TimingData::TimingData(const BPMs& bpms) {
+    segments.reserve(bpms.size() + 1);
+    ends.reserve(bpms.size());
+
+    // Charts start out at 120 BPM until the first change
+    Segment segment {0.f, 0.f, 120.f};
+    segments.push_back(segment);
+    float end = -std::numeric_limits<float>::infinity();
+    for (const BPM& change : bpms) {
+        segment.time += (change.beat - segment.beat) * 240.f / segment.bpm;
+        segment.beat = change.beat;
+        segment.bpm = change.bpm;
+        segments.push_back(segment);
+
+        // A NaN beat is never <= any beat, so nothing gets past it
+        if (std::isnan(change.beat))
+            end = std::numeric_limits<float>::infinity();
+        else
+            end = std::max(end, change.beat);
+        ends.push_back(end);
+    }
+}
+
+float TimingData::SegmentToSeconds(float beat, size_t segment) const {
+    const Segment& s = segments[segment];
+    return s.time + (beat - s.beat) * 240.f / s.bpm;
+}
+
+float TimingData::BeatToSeconds(float beat) const {
+    size_t segment = static_cast<size_t>(std::upper_bound(ends.begin(), ends.end(), beat) - ends.begin());
+    return SegmentToSeconds(beat, segment);
+}
+
+float TimingData::BeatToSeconds(float beat, size_t& segment) const {
+    if (segment > 0 && !(ends[segment - 1] <= beat))
+        segment = static_cast<size_t>(std::upper_bound(ends.begin(), ends.end(), beat) - ends.begin());
+    while (segment < ends.size() && ends[segment] <= beat)
+        segment++;
+    return SegmentToSeconds(beat, segment);
+}
+
+// isspace() in the "C" locale
+static bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+// Bit i of each mask says whether byte i of a 16 byte chunk is a tap ('1' or
+// '2'), a space, a newline or a comma
+struct ChunkMasks {
+    unsigned int taps;
+    unsigned int spaces;
+    unsigned int newlines;
+    unsigned int commas;
+};
+
+#ifdef SMLOADER_SSE2
+static ChunkMasks scan_chunk(const char* text) {
+    const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text));
+    const __m128i taps = _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('1')),
+                                      _mm_cmpeq_epi8(chunk, _mm_set1_epi8('2')));
+    // '\t' .. '\r' are 9 .. 13
+    const __m128i control = _mm_sub_epi8(chunk, _mm_set1_epi8('\t'));
+    const __m128i spaces = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(control, _mm_set1_epi8(4)), control),
+                                        _mm_cmpeq_epi8(chunk, _mm_set1_epi8(' ')));
+    return ChunkMasks {
+        static_cast<unsigned int>(_mm_movemask_epi8(taps)),
+        static_cast<unsigned int>(_mm_movemask_epi8(spaces)),
+        static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n')))),
+        static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(','))))
+    };
+}
+#else
+static ChunkMasks scan_chunk(const char* text) {
+    ChunkMasks masks {0, 0, 0, 0};
+    for (unsigned int i = 0; i < 16; i++) {
+        masks.taps |= static_cast<unsigned int>(text[i] == '1' || text[i] == '2') << i;
+        masks.spaces |= static_cast<unsigned int>(is_space(text[i])) << i;
+        masks.newlines |= static_cast<unsigned int>(text[i] == '\n') << i;
+        masks.commas |= static_cast<unsigned int>(text[i] == ',') << i;
+    }
+    return masks;
+}
+#endif
+
+/* Where the rows are in a chunk of a notes block made of plain rows: `width`
+note characters, optionally a '\r', then '\n', repeated. If a chunk matches,
+every row in it can be read straight off the tap mask. */
+struct RowLayout {
+    unsigned int width = 0; // 0 = no layout yet
+    unsigned int stride = 0; // Bytes per row, including the line ending
+    unsigned int rows = 0; // Whole rows per chunk
+    unsigned int used = 0; // Bytes of the chunk those rows cover
+    unsigned int newlines = 0;
+    unsigned int spaces = 0; // The newlines and '\r's
+    unsigned int starts = 0; // First byte of each row
+
+    RowLayout() = default;
+    RowLayout(unsigned int width, bool cr)
+        : width(width), stride(width + 1 + (cr ? 1 : 0)) {
+        rows = 16 / stride;
+        used = (1u << (rows * stride)) - 1;
+        for (unsigned int i = 0; i < rows; i++) {
+            newlines |= 1u << (i * stride + stride - 1);
+            if (cr)
+                spaces |= 1u << (i * stride + stride - 2);
+            starts |= 1u << (i * stride);
+        }
+        spaces |= newlines;
+    }
+
+    // A ',' at the start of a line ends the measure, anywhere else it's
+    // just another column
+    bool Matches(const ChunkMasks& masks) const {
+        return rows > 0
+            && (masks.newlines & used) == newlines
+            && (masks.spaces & used) == spaces
+            && (masks.commas & starts) == 0;
+    }
+
+    unsigned int Row(const ChunkMasks& masks, unsigned int i) const {
+        return (masks.taps >> (i * stride)) & ((1u << width) - 1);
+    }
+};
+
+// The rows of a measure were stored with their index in the measure as
+// time. Now that the measure's size is known, turn that into the time in
+// measures.
+static void finish_measure(NoteInfo* rows, size_t count, float measure_number, float measure_size) {
+    for (size_t i = 0; i < count; i++)
+        rows[i].rowTime = measure_number + rows[i].rowTime / measure_size;
+}
+
+/* Every line of a notes block is a row, with the columns' taps as bits, except
+for lines starting with ',', which end a measure. Whitespace is ignored and
+anything else counts as a column (so comments and blank lines are rows too,
+like they always were). Chunks of plain rows (see RowLayout) are decoded 16
+bytes at a time; anything else, and the line that tells us the row width,
+goes through the line-by-line path.
+
+Rows are written straight into the output, which is grown ahead of time so
+that a row can be written unconditionally and only kept if it has taps. */
+vector<NoteInfo> parse_main_block(string_view sm_text) {
+    // Sized ahead of the rows written into it and trimmed at the end. Rows
+    // are at least 2 bytes, but usually 5 or more.
+    vector<NoteInfo> output(sm_text.size() / 4 + 8);
+    NoteInfo* out = output.data();
+    size_t room = output.size();
+    size_t count = 0; // Rows kept so far
     float measure_size = 0.f;
     float measure_number = 0.f;
-    vector<int> measure;
-    for (std::string line; std::getline(sm_text, line); )
+    size_t measure_start = 0;
+    RowLayout layout;
+
+    const char* text = sm_text.data();
+    const char* end = text + sm_text.size();
+    while (text < end)
     {
-        notes = 0;
-        column_value = 1;
-        if (line[0] == ',') {
-            float inside = 0.f;
-            for(unsigned int note_row : measure) {
-                if (note_row != 0) {
-                    output.push_back(NoteInfo {note_row, measure_number + inside / measure_size});
+        // Room for a chunk's worth of rows (at most 8) or one line
+        if (room - count < 8) {
+            output.resize(room * 2);
+            out = output.data();
+            room = output.size();
+        }
+
+        if (end - text >= 16) {
+            ChunkMasks masks = scan_chunk(text);
+            if (layout.Matches(masks)) {
+                for (unsigned int i = 0; i < layout.rows; i++) {
+                    unsigned int notes = layout.Row(masks, i);
+                    out[count] = NoteInfo {notes, measure_size};
+                    count += notes != 0;
+                    measure_size += 1.f;
                 }
-                inside += 1.f;
+                text += layout.rows * layout.stride;
+                continue;
             }
+        }
+
+        const char* line_end = static_cast<const char*>(std::memchr(text, '\n', static_cast<size_t>(end - text)));
+        if (line_end == nullptr)
+            line_end = end;
+        const char* line = text;
+        text = line_end == end ? end : line_end + 1;
+
+        if (line != line_end && line[0] == ',') {
+            finish_measure(out + measure_start, count - measure_start, measure_number, measure_size);
+            measure_start = count;
             measure_number += 1.f;
-            measure.clear();
             measure_size = 0.f;
             continue;
         }
-        for(char & it : line) {
-            if (it == '\n') {
-                break;
-            }
-            if (isspace(it)) {
+
+        // Unsigned, so that lines over 32 columns (comments) wrap around
+        // to 0 like they always did
+        unsigned int notes = 0;
+        unsigned int column_value = 1;
+        unsigned int width = 0;
+        bool plain = true; // Only spaces are a '\r' at the end
+        for (const char* it = line; it != line_end; it++) {
+            if (is_space(*it)) {
+                plain = plain && *it == '\r' && it + 1 == line_end;
                 continue;
             }
-            if (it == '1' || it == '2') {
+            if (*it == '1' || *it == '2') {
                 notes += column_value;
             }
             column_value *= 2;
+            width++;
         }
+        if (plain && width > 0 && width < 16)
+            layout = RowLayout(width, line_end != line && line_end[-1] == '\r');
+
+        out[count] = NoteInfo {notes, measure_size};
+        count += notes != 0;
         measure_size += 1.f;
-        measure.push_back(notes);
     }
-    float inside = 0.f;
-    for(unsigned int note_row : measure) {
-        if (note_row != 0) {
-            output.push_back(NoteInfo{note_row, measure_number + inside / measure_size});
-        }
-        inside += 1.f;
-    }
-    measure.clear();
+    output.resize(count);
+    finish_measure(output.data() + measure_start, count - measure_start, measure_number, measure_size);
 
     return output;
 }
 
-BPMs parse_bpms_block(stringstream& bpms_block) {
-    float next_time;
-    float next_bpm;
+/* Reads the BPMS block like the istringstream it used to be read with did,
+so that odd blocks (trailing commas, stray whitespace, a missing value) come
+out the same. That means a read that hits the end of the text leaves its value
+alone and fails every read after it, like a stream's failbit; and numbers are
+taken as `stream >> float` takes them. The one difference is that a character
+that can't start a number gets skipped, where the stream got stuck on it
+forever. */
+class BPMScanner
+{
+public:
+    explicit BPMScanner(string_view text) : text(text) {}
+
+    size_t avail() const { return text.size() - pos; }
+
+    // Next character, or EOF
+    int get() {
+        if (eof || failed || pos == text.size()) {
+            eof = eof || pos == text.size();
+            failed = true;
+            return EOF;
+        }
+        return static_cast<unsigned char>(text[pos++]);
+    }
+
+    bool read_float(float& value) {
+        if (eof || failed) {
+            failed = true;
+            return false;
+        }
+        while (pos < text.size() && is_space(text[pos]))
+            pos++;
+        if (pos == text.size()) {
+            eof = failed = true;
+            return false;
+        }
+
+        // [+-]digits[.digits][(e|E)[+-]digits]
+        size_t start = pos;
+        bool found_digits = false;
+        bool found_point = false;
+        if (text[pos] == '+' || text[pos] == '-')
+            pos++;
+        for (; pos < text.size(); pos++) {
+            char c = text[pos];
+            if (c >= '0' && c <= '9') {
+                found_digits = true;
+            } else if (c == '.' && !found_point) {
+                found_point = true;
+            } else if ((c == 'e' || c == 'E') && found_digits) {
+                pos++;
+                if (pos < text.size() && (text[pos] == '+' || text[pos] == '-'))
+                    pos++;
+                while (pos < text.size() && text[pos] >= '0' && text[pos] <= '9')
+                    pos++;
+                break;
+            } else {
+                break;
+            }
+        }
+        eof = pos == text.size();
+
+        char token[64];
+        size_t length = pos - start;
+        if (length == 0 || length >= sizeof token) {
+            value = 0.f;
+            failed = true;
+            return false;
+        }
+        text.copy(token, length, start);
+        token[length] = '\0';
+        char* parsed_end;
+        value = std::strtof(token, &parsed_end);
+        if (parsed_end != token + length) {
+            value = 0.f;
+            failed = true;
+            return false;
+        }
+        return true;
+    }
+
+    // Steps over a character a number couldn't be read from
+    void skip() {
+        failed = false;
+        pos++;
+    }
+
+private:
+    string_view text;
+    size_t pos = 0;
+    bool eof = false;
+    bool failed = false;
+};
+
+BPMs parse_bpms_block(string_view bpms_text) {
+    BPMScanner bpms_block(bpms_text);
+    // NaN until read. A block without a full first entry (e.g. only
+    // whitespace) used to produce a BPM change from uninitialized floats;
+    // now it produces none.
+    float next_time = std::numeric_limits<float>::quiet_NaN();
+    float next_bpm = std::numeric_limits<float>::quiet_NaN();
     BPMs bpm_list = vector<BPM>();
-    while (bpms_block.rdbuf()->in_avail()) {
-        while (!(bpms_block >> next_time)) {
-            if (!bpms_block.rdbuf()->in_avail())
+    while (bpms_block.avail()) {
+        while (!bpms_block.read_float(next_time)) {
+            if (!bpms_block.avail())
                 break;
-            bpms_block.get();
+            bpms_block.skip();
         }
         while (bpms_block.get() != '=') {
-            if (!bpms_block.rdbuf()->in_avail())
+            if (!bpms_block.avail())
                 break;
         }
-        while (!(bpms_block >> next_bpm)) {
-            if (!bpms_block.rdbuf()->in_avail())
+        while (!bpms_block.read_float(next_bpm)) {
+            if (!bpms_block.avail())
                 break;
-            bpms_block.get();
+            bpms_block.skip();
         }
         while (bpms_block.get() != ',') {
-            if (!bpms_block.rdbuf()->in_avail())
+            if (!bpms_block.avail())
                 break;
         }
+        if (std::isnan(next_time) || std::isnan(next_bpm))
+            continue;
         bpm_list.push_back(BPM{next_time / 4.f, next_bpm});
     }
     return bpm_list;
-}
\ No newline at end of file
+}
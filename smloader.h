@@ -7,6 +7,7 @@
 
 #include <vector>
 #include <fstream>
+#include <string_view>
 #include "NoteDataStructures.h"
 
 typedef std::vector<ChartInfo> SMNotes;
@@ -18,6 +19,50 @@ struct BPM {
 
 typedef std::vector<BPM> BPMs;
 
+/* Converts beats (in the loader's unit of 4 beats, see parse_bpms_block) to
+seconds. Built once from a chart's BPM changes: every change starts a segment
+that knows its start beat, the time at which it starts and its BPM, so the
+conversion is a search for the segment plus one multiply-add instead of a walk
+over every change before the beat. This is also where #STOPS and #OFFSET
+would go, as further segments and a shift of every segment's time.
+
+The changes are taken in file order, like they always were: a beat uses the
+segment of the last change before the first one that lies after the beat. */
+class TimingData
+{
+public:
+    explicit TimingData(const BPMs& bpms);
+
+    // Binary search for the segment
+    float BeatToSeconds(float beat) const;
+
+    /* For converting beats in non-decreasing order. `segment` is the segment
+    of the previous beat (0 to start with) and only ever moves forward, so
+    converting n beats costs O(n + segments). Falls back to a binary search
+    if a beat goes backwards. */
+    float BeatToSeconds(float beat, size_t& segment) const;
+
+private:
+    struct Segment {
+        float beat;
+        float time;
+        float bpm;
+    };
+
+    float SegmentToSeconds(float beat, size_t segment) const;
+
+    std::vector<Segment> segments;
+    // ends[i] is the first beat at which segment i is left behind: the
+    // largest start beat of segments 1 .. i + 1. Non-decreasing, so it can
+    // be binary searched.
+    std::vector<float> ends;
+};
+
+// Reads the whole file in one go and parses it with load_from_buffer
 SMNotes load_from_file(std::ifstream& sm_file);
 
+// Parses the text of a .sm file. Works on views into the text throughout, so
+// nothing but the parsed rows and difficulty names gets copied.
+SMNotes load_from_buffer(std::string_view sm_text);
+
 #endif //MINACALC_SMLOADER_H
@@ -0,0 +1,344 @@
+#include "chartgen.h"
+#include "smloader.h"
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::stringstream;
+using std::vector;
+
+/* minacalc_smloader_test
+
+Checks load_from_buffer against the loader it replaced, kept below as it
+was apart from taking the text instead of a file: the difficulty names, the
+rows and their times have to come out the same, bit for bit. Runs over the
+generated charts and a few hand written files with what the fast paths of
+parse_main_block don't take (comments, blank lines, CRLF, 6 columns, BPM
+changes), and random notes blocks of every row width its 16 byte decoder
+takes. Run by ctest. */
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const string& what) {
+    if (ok)
+        return;
+    failures++;
+    std::cerr << "FAIL: " << what << '\n';
+}
+
+namespace reference {
+
+vector<NoteInfo> parse_main_block(stringstream& sm_text) {
+    vector<NoteInfo> output;
+    int notes;
+    int column_value;
+    float measure_size = 0.f;
+    float measure_number = 0.f;
+    vector<int> measure;
+    for (std::string line; std::getline(sm_text, line); )
+    {
+        notes = 0;
+        column_value = 1;
+        if (line[0] == ',') {
+            float inside = 0.f;
+            for(unsigned int note_row : measure) {
+                if (note_row != 0) {
+                    output.push_back(NoteInfo {note_row, measure_number + inside / measure_size});
+                }
+                inside += 1.f;
+            }
+            measure_number += 1.f;
+            measure.clear();
+            measure_size = 0.f;
+            continue;
+        }
+        for(char & it : line) {
+            if (it == '\n') {
+                break;
+            }
+            if (isspace(it)) {
+                continue;
+            }
+            if (it == '1' || it == '2') {
+                notes += column_value;
+            }
+            column_value *= 2;
+        }
+        measure_size += 1.f;
+        measure.push_back(notes);
+    }
+    float inside = 0.f;
+    for(unsigned int note_row : measure) {
+        if (note_row != 0) {
+            output.push_back(NoteInfo{note_row, measure_number + inside / measure_size});
+        }
+        inside += 1.f;
+    }
+    measure.clear();
+
+    return output;
+}
+
+BPMs parse_bpms_block(stringstream& bpms_block) {
+    float next_time;
+    float next_bpm;
+    BPMs bpm_list = vector<BPM>();
+    while (bpms_block.rdbuf()->in_avail()) {
+        while (!(bpms_block >> next_time)) {
+            if (!bpms_block.rdbuf()->in_avail())
+                break;
+            bpms_block.get();
+        }
+        while (bpms_block.get() != '=') {
+            if (!bpms_block.rdbuf()->in_avail())
+                break;
+        }
+        while (!(bpms_block >> next_bpm)) {
+            if (!bpms_block.rdbuf()->in_avail())
+                break;
+            bpms_block.get();
+        }
+        while (bpms_block.get() != ',') {
+            if (!bpms_block.rdbuf()->in_avail())
+                break;
+        }
+        bpm_list.push_back(BPM{next_time / 4.f, next_bpm});
+    }
+    return bpm_list;
+}
+
+SMNotes load(string sm_text) {
+    SMNotes raw_block;
+    BPMs bpms;
+    while (!sm_text.empty()) {
+        size_t next_tag_position = sm_text.find('#');
+        if (next_tag_position == string::npos)
+            break;
+        sm_text = sm_text.substr(next_tag_position + 1);
+        if (sm_text.substr(0,5) == "NOTES") {
+            for (int i = 0; i < 3; i++) {
+                next_tag_position = sm_text.find(':');
+                if (next_tag_position == string::npos)
+                    break;
+                sm_text = sm_text.substr(next_tag_position + 1);
+            }
+            std::string difficulty_name = sm_text.substr(0,sm_text.find(':'));
+            for (int i = 0; i < 3; i++) {
+                next_tag_position = sm_text.find(':');
+                if (next_tag_position == string::npos)
+                    break;
+                sm_text = sm_text.substr(next_tag_position + 1);
+            }
+            stringstream notes_block;
+            next_tag_position = sm_text.find(';');
+            notes_block << sm_text.substr(sm_text.find('\n')+1, next_tag_position-1);
+            raw_block.push_back(ChartInfo {difficulty_name, parse_main_block(notes_block)});
+            sm_text = sm_text.substr(next_tag_position + 1);
+        } else if (sm_text.substr(0,4) == "BPMS") {
+            next_tag_position = sm_text.find(':');
+            sm_text = sm_text.substr(next_tag_position + 1);
+            next_tag_position = sm_text.find(';');
+            stringstream bpms_block;
+            bpms_block << sm_text.substr(0, next_tag_position);
+            bpms = parse_bpms_block(bpms_block);
+            sm_text = sm_text.substr(next_tag_position + 1);
+        }
+    }
+    for (ChartInfo& chart : raw_block)
+        for (NoteInfo& timestamp : chart.notes) {
+            size_t next_bpm_index = 0;
+            float last_bpm = 120.f;
+            float last_bpm_time = 0.f;
+            float last_bpm_beat = 0.f;
+            while (next_bpm_index < bpms.size() && bpms[next_bpm_index].beat <= timestamp.rowTime) {
+                last_bpm_time += (bpms[next_bpm_index].beat - last_bpm_beat) * 240.f / last_bpm;
+                last_bpm_beat = bpms[next_bpm_index].beat;
+                last_bpm = bpms[next_bpm_index].bpm;
+                next_bpm_index += 1;
+            }
+            timestamp.rowTime = last_bpm_time + (timestamp.rowTime - last_bpm_beat) * 240.f / last_bpm;
+        }
+    return raw_block;
+}
+
+} // namespace reference
+
+void compare(const string& name, const string& text) {
+    SMNotes got = load_from_buffer(text);
+    SMNotes expected = reference::load(text);
+    check(got.size() == expected.size(), name + ": " + std::to_string(got.size()) + " charts instead of " +
+                                             std::to_string(expected.size()));
+    for (size_t c = 0; c < got.size() && c < expected.size(); c++) {
+        string chart = name + " chart " + std::to_string(c);
+        check(got[c].difficultyName == expected[c].difficultyName, chart + ": difficulty \"" +
+                                                                       got[c].difficultyName + "\" instead of \"" +
+                                                                       expected[c].difficultyName + "\"");
+        const vector<NoteInfo>& a = got[c].notes;
+        const vector<NoteInfo>& b = expected[c].notes;
+        check(a.size() == b.size(),
+              chart + ": " + std::to_string(a.size()) + " rows instead of " + std::to_string(b.size()));
+        for (size_t i = 0; i < a.size() && i < b.size(); i++) {
+            bool ok = a[i].notes == b[i].notes && std::memcmp(&a[i].rowTime, &b[i].rowTime, sizeof(float)) == 0;
+            check(ok, chart + " row " + std::to_string(i) + ": " + std::to_string(a[i].notes) + " at " +
+                          std::to_string(a[i].rowTime) + " instead of " + std::to_string(b[i].notes) + " at " +
+                          std::to_string(b[i].rowTime));
+            if (!ok)
+                break;
+        }
+    }
+}
+
+string with_crlf(const string& text) {
+    string converted;
+    for (char c : text) {
+        if (c == '\n')
+            converted += '\r';
+        converted += c;
+    }
+    return converted;
+}
+
+// splitmix64
+class Random
+{
+public:
+    explicit Random(uint64_t seed) : state(seed) {}
+
+    uint64_t Next() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    // In [0, n)
+    unsigned int Below(unsigned int n) { return static_cast<unsigned int>(Next() % n); }
+
+private:
+    uint64_t state;
+};
+
+/* A notes block for the 16 byte decoder of parse_main_block: long runs of
+plain rows `width` columns wide, so that whole chunks of them match a
+RowLayout, broken up by now and then a line it has to leave to the line by
+line path (a different width, stray spaces, a comment, a blank line, a ','
+that isn't at the start) and by measures of every size. */
+string decoder_block(Random& random, unsigned int width) {
+    const char cells[] = "0000000112234M";
+    string text = "#BPMS:0.000=170.000;\n#NOTES:\n     dance-single:\n     :\n     Hard:\n     1:\n     :\n";
+    for (int measure = 0; measure < 200; measure++) {
+        unsigned int rows = 1 + random.Below(48);
+        for (unsigned int r = 0; r < rows; r++) {
+            unsigned int columns = width;
+            switch (random.Below(40)) {
+            case 0: columns = 1 + random.Below(15); break;
+            case 1: text += "  "; break;
+            case 2: text += "// comment\n"; continue;
+            case 3: text += "\n"; continue;
+            case 4: text += "0,"; columns--; break;
+            default: break;
+            }
+            for (unsigned int c = 0; c < columns; c++)
+                text += cells[random.Below(sizeof cells - 1)];
+            text += '\n';
+        }
+        text += ",\n";
+    }
+    text += "0000\n;\n";
+    return text;
+}
+
+const char* const handwritten = R"(#TITLE:handwritten;
+#BPMS:0.000=150.000,
+16.000=210.500
+,32.000=90.000,64.000=180.000;
+#NOTES:
+     dance-single:
+     someone:
+     Challenge:
+     20:
+     0,0,0,0,0:
+1000
+0100
+// a comment is a row too
+0010
+
+0001
+,
+1100
+ 0110
+0011
+1001
+2000
+0M00
+0020
+0003
+,  // measure 3
+10000000
+01000000
+00100000
+00010000
+,
+1111
+,
+0000
+0000
+0000
+1000
+;
+#NOTES:
+     dance-solo:
+     someone:
+     Hard:
+     15:
+     0,0,0,0,0:
+100000
+010000
+001000
+000100
+000010
+000001
+101010
+010101
+,
+111111
+000000
+;
+)";
+
+} // namespace
+
+int main() {
+    for (int p = 0; p < NUM_CHART_PATTERNS; p++)
+        for (float seconds : {5.f, 120.f}) {
+            ChartGenOptions options;
+            options.pattern = static_cast<ChartPattern>(p);
+            options.seconds = seconds;
+            string text = generate_sm(options);
+            string name = string(pattern_name(options.pattern)) + " " + std::to_string(static_cast<int>(seconds)) + "s";
+            compare(name, text);
+            compare(name + " CRLF", with_crlf(text));
+        }
+    Random random(12);
+    for (unsigned int width = 1; width < 16; width++) {
+        string text = decoder_block(random, width);
+        compare("decoder block, width " + std::to_string(width), text);
+        compare("decoder block CRLF, width " + std::to_string(width), with_crlf(text));
+    }
+    compare("handwritten", handwritten);
+    compare("handwritten CRLF", with_crlf(handwritten));
+
+    if (failures > 0) {
+        std::cerr << failures << " checks failed\n";
+        return 1;
+    }
+    std::cerr << "all checks passed\n";
+    return 0;
+}
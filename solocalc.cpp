@@ -6,6 +6,8 @@
 #include <cmath>
 #include <algorithm>
 #include "NoteDataStructures.h"
+#include "calckernels.h"
+#include "intervallist.h"
 
 using std::vector;
 
@@ -36,7 +38,7 @@ inline void DifficultyMSSmooth(vector<float>& input) {
     }
 }
 
-float CalcMSEstimate(vector<float>& input) {
+float CalcMSEstimate(IntervalRange<float> input) {
     if (input.empty())
         return 0.f;
 
@@ -48,21 +50,19 @@ float CalcMSEstimate(vector<float>& input) {
     return 1375.f * End / m;
 }
 
-float CalcInternal(float x, vector<float>& diff, vector<int>& v_itvpoints) {
-    float output = 0.f;
-    for (size_t i = 0; i < diff.size(); i++) {
-        output += x > diff[i] ? v_itvpoints[i] : v_itvpoints[i] * std::pow(x / diff[i], 1.8f);
-    }
-    return output;
+float CalcInternal(float x, vector<float>& diff, vector<int>& v_itvpoints, bool fast_points) {
+    if (fast_points)
+        return ExpectedPointsFast(x, diff.data(), v_itvpoints.data(), diff.size());
+    return ExpectedPoints(x, diff.data(), v_itvpoints.data(), diff.size());
 }
 
-float Chisel(float score_goal, vector<float>& ldiff, vector<int>& lv_itvpoints, vector<float>& rdiff, vector<int>& rv_itvpoints, float MaxPoints) {
+float Chisel(float score_goal, vector<float>& ldiff, vector<int>& lv_itvpoints, vector<float>& rdiff, vector<int>& rv_itvpoints, float MaxPoints, bool fast_points) {
     float lower = 0.0f;
     float upper = 100.0f;
     float gotpoints;
     while (upper - lower > 0.01f) {
         float mid = (lower + upper) / 2.f;
-        gotpoints = CalcInternal(mid, ldiff, lv_itvpoints) + CalcInternal(mid, rdiff, rv_itvpoints);
+        gotpoints = CalcInternal(mid, ldiff, lv_itvpoints, fast_points) + CalcInternal(mid, rdiff, rv_itvpoints, fast_points);
         if (gotpoints / MaxPoints < score_goal) {
             lower = mid;
         } else {
@@ -72,7 +72,7 @@ float Chisel(float score_goal, vector<float>& ldiff, vector<int>& lv_itvpoints,
     return lower;
 }
 
-void setHandDiffs(vector<float>& NPSdiff, vector<float>& MSdiff, vector<vector<vector<float> > >& AllIntervals, int column) {
+void setHandDiffs(vector<float>& NPSdiff, vector<float>& MSdiff, vector<IntervalList<float> >& AllIntervals, int column) {
     for (size_t i = 0; i < AllIntervals[column].size(); i++) {
         float nps = 1.6f * static_cast<float>(AllIntervals[column][i].size() + AllIntervals[column + 1][i].size() + AllIntervals[column + 2][i].size());
         float left_difficulty = CalcMSEstimate(AllIntervals[column][i]);
@@ -86,26 +86,29 @@ void setHandDiffs(vector<float>& NPSdiff, vector<float>& MSdiff, vector<vector<v
     DifficultyMSSmooth(MSdiff);
 }
 
-float soloCalc(const std::vector<NoteInfo>& notes, float music_rate, float goal) {
-    vector<vector<vector<float> > > AllIntervals(6, vector<vector<float> >());
+float soloCalc(const std::vector<NoteInfo>& notes, float music_rate, float goal, bool fast_points) {
+    // Each column's ms values, one list per interval
+    vector<IntervalList<float> > AllIntervals(6);
     int num_itv = static_cast<int>(std::ceil(notes.back().rowTime / (music_rate * 0.5f)));
+    num_itv = std::max(num_itv, 1);
     for(unsigned int t = 0; t < 6; t++) {
         int Interval = 0;
         float last = -5.f;
-        AllIntervals[t] = vector<vector<float> >(num_itv, vector<float>());
+        AllIntervals[t].Reset(num_itv);
         unsigned int column = 1u << t;
 
         for (auto i : notes) {
             float scaledtime = i.rowTime / music_rate;
 
-            while (scaledtime > static_cast<float>(Interval + 1) * 0.5f)
+            while (scaledtime > static_cast<float>(Interval + 1) * 0.5f && Interval + 1 < num_itv)
                 ++Interval;
 
             if (i.notes & column) {
-                AllIntervals[t][Interval].emplace_back(std::min(std::max(1000 * (scaledtime - last), 40.f), 5000.f));
+                AllIntervals[t].Append(Interval, std::min(std::max(1000 * (scaledtime - last), 40.f), 5000.f));
                 last = scaledtime;
             }
         }
+        AllIntervals[t].Finish();
     }
     vector<float> lv_itvNPSdiff(AllIntervals[0].size());
     vector<float> lv_itvMSdiff(AllIntervals[0].size());
@@ -127,5 +130,5 @@ float soloCalc(const std::vector<NoteInfo>& notes, float music_rate, float goal)
     for (size_t i = 0; i < lv_itvpoints.size(); i++)
         MaxPoints += static_cast<float>(lv_itvpoints[i] + rv_itvpoints[i]);
 
-    return Chisel(goal, lv_itvMSdiff, lv_itvpoints, rv_itvMSdiff, rv_itvpoints, MaxPoints);
+    return Chisel(goal, lv_itvMSdiff, lv_itvpoints, rv_itvMSdiff, rv_itvpoints, MaxPoints, fast_points);
 }
\ No newline at end of file
@@ -8,6 +8,9 @@
 #include "NoteDataStructures.h"
 
 //This is a very basic difficulty calculator for solo files that I am putting together as a proof of concept
-float soloCalc(const std::vector<NoteInfo>& NoteInfo, float musicrate, float goal);
+// fast_points swaps in ExpectedPointsFast, see calckernels.h. SortedPoints
+// isn't offered: the bisection only probes about 14 skills, fewer than it
+// takes to make up for sorting.
+float soloCalc(const std::vector<NoteInfo>& NoteInfo, float musicrate, float goal, bool fast_points = false);
 
 #endif //MINACALC_SOLOCALC_H
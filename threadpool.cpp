@@ -0,0 +1,162 @@
+#include "threadpool.h"
+#include <algorithm>
+
+namespace {
+// Lets Submit() find the deque of the worker it's being called from
+thread_local const ThreadPool* current_pool = nullptr;
+thread_local unsigned int current_index = 0;
+}
+
+ThreadPool::ThreadPool(unsigned int num_threads) {
+    if (num_threads == 0)
+        num_threads = std::thread::hardware_concurrency();
+    if (num_threads == 0)
+        num_threads = 1;
+    num_threads = std::min(num_threads, MAX_POOL_THREADS);
+
+    for (unsigned int i = 0; i < num_threads; i++)
+        queues.emplace_back(new Queue());
+    for (unsigned int i = 0; i < num_threads; i++)
+        workers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        stopping = true;
+    }
+    wake_workers.notify_all();
+    for (std::thread& worker : workers)
+        worker.join();
+}
+
+void ThreadPool::Submit(Task task) {
+    unsigned int index = current_pool == this ? current_index : next_queue++ % Size();
+
+    // Counted before the task can be seen, so a worker that pops it right
+    // away never takes `queued` below zero
+    ++unfinished;
+    ++queued;
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        queues[index]->tasks.push_back(std::move(task));
+    }
+
+    // Taking the lock orders this against a worker that has just seen an
+    // empty pool and is about to go to sleep
+    { std::lock_guard<std::mutex> lock(sleep_mutex); }
+    wake_workers.notify_one();
+}
+
+void ThreadPool::Wait() {
+    std::unique_lock<std::mutex> lock(sleep_mutex);
+    all_done.wait(lock, [this] { return unfinished.load() == 0; });
+}
+
+void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t)>& job) {
+    if (count == 0)
+        return;
+
+    // Helper tasks can start after we've returned, so they must not
+    // touch anything on our stack
+    struct Shared {
+        std::function<void(size_t)> job;
+        std::atomic<size_t> next{0};
+        std::atomic<size_t> done{0};
+        size_t count;
+    };
+    auto shared = std::make_shared<Shared>();
+    shared->job = job;
+    shared->count = count;
+
+    auto take_jobs = [this](Shared& s) {
+        for (size_t i = s.next++; i < s.count; i = s.next++) {
+            s.job(i);
+            // The caller sleeps with the workers, see below
+            if (++s.done == s.count) {
+                std::lock_guard<std::mutex> lock(sleep_mutex);
+                wake_workers.notify_all();
+            }
+        }
+    };
+
+    size_t helpers = std::min<size_t>(count - 1, Size());
+    for (size_t i = 0; i < helpers; i++)
+        Submit([shared, take_jobs] { take_jobs(*shared); });
+
+    take_jobs(*shared);
+
+    // Every job has been taken. Until the ones other threads took have
+    // finished, run whatever else gets queued (e.g. the jobs of a
+    // ParallelFor nested in them), and only sleep while there is nothing
+    unsigned int home = HomeQueue();
+    Task task;
+    while (shared->done.load() < count) {
+        if (TryPop(home, task)) {
+            Run(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        wake_workers.wait(lock, [&] { return queued.load() > 0 || shared->done.load() == count; });
+    }
+}
+
+unsigned int ThreadPool::HomeQueue() const {
+    return current_pool == this ? current_index : 0;
+}
+
+bool ThreadPool::TryPop(unsigned int home, Task& task) {
+    if (queued.load() == 0)
+        return false;
+
+    {
+        Queue& own = *queues[home];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            --queued;
+            return true;
+        }
+    }
+
+    for (unsigned int i = 1; i < Size(); i++) {
+        Queue& victim = *queues[(home + i) % Size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            --queued;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::Run(Task& task) {
+    task();
+    task = nullptr;
+
+    if (--unfinished == 0) {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        all_done.notify_all();
+    }
+}
+
+void ThreadPool::WorkerLoop(unsigned int index) {
+    current_pool = this;
+    current_index = index;
+
+    Task task;
+    for (;;) {
+        if (TryPop(index, task)) {
+            Run(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        wake_workers.wait(lock, [this] { return stopping || queued.load() > 0; });
+        if (stopping && queued.load() == 0)
+            return;
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef MINACALC_THREADPOOL_H
+#define MINACALC_THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Work-stealing thread pool. Every worker owns a deque of tasks: it pushes
+and pops work at the back of its own deque, and when that runs dry it steals
+from the front of the other workers' deques. Tasks submitted from inside a
+task land on the submitting worker's deque, so follow-up work (e.g. rating
+the charts a parse task just produced) stays hot in that worker's cache
+unless somebody else is idle and takes it. */
+// More workers than this is a typo, not a machine
+const unsigned int MAX_POOL_THREADS = 256;
+
+class ThreadPool
+{
+public:
+    typedef std::function<void()> Task;
+
+    // 0 threads means one per hardware thread; more than MAX_POOL_THREADS
+    // get MAX_POOL_THREADS
+    explicit ThreadPool(unsigned int num_threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void Submit(Task task);
+
+    // Blocks until every submitted task has finished, including tasks
+    // submitted by other tasks. Must not be called from inside a task.
+    void Wait();
+
+    // Runs job(0) .. job(count - 1) on the pool and returns once all of
+    // them have finished. The calling thread takes jobs too and runs
+    // other queued tasks while it waits, so this can be nested inside a
+    // task.
+    void ParallelFor(size_t count, const std::function<void(size_t)>& job);
+
+    unsigned int Size() const { return static_cast<unsigned int>(queues.size()); }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void WorkerLoop(unsigned int index);
+    // Index of the caller's own deque; outside threads share deque 0
+    unsigned int HomeQueue() const;
+    // Pops from the back of queue `home` or steals from the front of the
+    // others. Returns false if every queue is empty.
+    bool TryPop(unsigned int home, Task& task);
+    void Run(Task& task);
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+
+    std::atomic<size_t> queued{0}; // tasks sitting in a deque or being pushed into one
+    std::atomic<size_t> unfinished{0}; // queued + running tasks
+    std::atomic<unsigned int> next_queue{0};
+    bool stopping = false;
+
+    std::mutex sleep_mutex;
+    std::condition_variable wake_workers;
+    std::condition_variable all_done;
+};
+
+#endif //MINACALC_THREADPOOL_H